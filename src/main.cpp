@@ -1,13 +1,70 @@
 #include <algorithm>
 #include <iostream>
+#include <fstream>
 #include <cmath>
 #include <string>
 #include <sstream>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <memory>
 
 #include "sort-test.h"
 #include "timsort.h"
 
 
+// Every allocation of the test binary is counted, see testAllocations
+void* countedAllocation(size_t size) noexcept {
+	++AllocationCounter::count();
+	return std::malloc(size == 0 ? 1 : size);
+}
+// Not inlined into the operators delete: GCC would pair the std::free with the operator new
+// the pointer came from and warn about mismatched allocation functions
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void releaseAllocation(void* p) noexcept {
+	std::free(p);
+}
+void* operator new(size_t size) {
+	void* p = countedAllocation(size);
+	if (p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+	return countedAllocation(size);
+}
+void* operator new[](size_t size) {
+	void* p = countedAllocation(size);
+	if (p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+	return countedAllocation(size);
+}
+void operator delete(void* p) noexcept {
+	releaseAllocation(p);
+}
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+	releaseAllocation(p);
+}
+void operator delete(void* p, size_t) noexcept {
+	releaseAllocation(p);
+}
+void operator delete[](void* p) noexcept {
+	releaseAllocation(p);
+}
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+	releaseAllocation(p);
+}
+void operator delete[](void* p, size_t) noexcept {
+	releaseAllocation(p);
+}
+
+
 int intAllocator(unsigned long long random) {
 	return random & 0xFFFFFFFF;
 }
@@ -28,6 +85,14 @@ double doubleAllocator(unsigned long long random) {
 	return static_cast<double>(random) * std::pow(0.9, static_cast<double>(random & 0xF));
 }
 
+float floatAllocator(unsigned long long random) {
+	return static_cast<float>(doubleAllocator(random));
+}
+
+unsigned long long uint64Allocator(unsigned long long random) {
+	return random * 0x9E3779B97F4A7C15ULL;
+}
+
 
 class Point {
 private:
@@ -83,6 +148,54 @@ public:
 	}
 };
 
+// The same order as PointComparator, as a key computed once per point
+class PointDistance {
+private:
+	Point pivot;
+
+public:
+	PointDistance(const Point& pivot)
+		:pivot(pivot)
+	{}
+
+	double operator ()(const Point& a) const {
+		return std::pow(pivot.getX() - a.getX(), 2.0) +
+					std::pow(pivot.getY() - a.getY(), 2.0) +
+					std::pow(pivot.getZ() - a.getZ(), 2.0);
+	}
+};
+
+// Copying is not declared, so any copy inside the sort fails to compile
+class MoveOnlyInt {
+private:
+	int value;
+
+	MoveOnlyInt(const MoveOnlyInt&);
+	MoveOnlyInt& operator =(const MoveOnlyInt&);
+
+public:
+	explicit MoveOnlyInt(int value)
+		:value(value)
+	{}
+
+	MoveOnlyInt(MoveOnlyInt&& other)
+		:value(other.value)
+	{}
+
+	MoveOnlyInt& operator =(MoveOnlyInt&& other) {
+		value = other.value;
+		return *this;
+	}
+
+	bool operator <(const MoveOnlyInt& other) const {
+		return value < other.value;
+	}
+};
+
+bool intComparator(const int& a, const int& b) {
+	return a < b;
+}
+
 class StringPointerComparator {
 public:
 	bool operator ()(std::string* const a, std::string* const b) const {
@@ -177,43 +290,79 @@ public:
 		return 1;
 	}
 };
+class TimParamsNoBuffer: public DefaultTimSortParams {
+public:
+	size_t GetBufferBudget() const {
+		return 0;
+	}
+};
 
+class TimParamsSmallBuffer: public DefaultTimSortParams {
+public:
+	size_t GetBufferBudget() const {
+		return 1 << 20;
+	}
+};
+
+class TimParamsParallel: public DefaultTimSortParams {
+public:
+	unsigned int GetThreadsCount() const {
+		return 4;
+	}
+};
+
+
+enum ESortAlgorithm {
+	SA_TimSort,
+	SA_StdSort,
+	SA_StdStableSort
+};
 
 class SortingFunctor {
 private:
-	const bool stdSort;
+	const ESortAlgorithm algorithm;
+
+	template <class RandomAccessIterator, class Compare>
+	void baselineSort(RandomAccessIterator first, RandomAccessIterator last, const Compare& comp) const {
+		if (algorithm == SA_StdStableSort)
+			std::stable_sort(first, last, comp);
+		else
+			std::sort(first, last, comp);
+	}
 
 public:
-	SortingFunctor(bool std)
-		:stdSort(std)
+	SortingFunctor(ESortAlgorithm algorithm)
+		:algorithm(algorithm)
 	{}
 
-	template <class RandomAccessIterator, class Compare>
+	template <class RandomAccessIterator, class Compare, class Params>
 	void operator ()(RandomAccessIterator first, RandomAccessIterator last,
-			const Compare& comp, const ITimSortParams& params) const {
-		if (stdSort)
-			std::sort(first, last, comp);
+			const Compare& comp, const Params& params) const {
+		if (algorithm != SA_TimSort)
+			baselineSort(first, last, comp);
 		else
 			TimSort(first, last, comp, params);
 	}
 	template <class RandomAccessIterator, class Compare>
 	void operator ()(RandomAccessIterator first, RandomAccessIterator last, const Compare& comp) const {
-		if (stdSort)
-			std::sort(first, last, comp);
+		if (algorithm != SA_TimSort)
+			baselineSort(first, last, comp);
 		else
 			TimSort(first, last, comp);
 	}
 	template <class RandomAccessIterator>
 	void operator ()(RandomAccessIterator first, RandomAccessIterator last, const ITimSortParams& params) const {
-		if (stdSort)
-			std::sort(first, last);
+		typedef typename std::iterator_traits<RandomAccessIterator>::value_type Value;
+		if (algorithm != SA_TimSort)
+			baselineSort(first, last, std::less<Value>());
 		else
 			TimSort(first, last, params);
 	}
 	template <class RandomAccessIterator>
 	void operator ()(RandomAccessIterator first, RandomAccessIterator last) const {
-		if (stdSort)
-			std::sort(first, last);
+		typedef typename std::iterator_traits<RandomAccessIterator>::value_type Value;
+		if (algorithm != SA_TimSort)
+			baselineSort(first, last, std::less<Value>());
 		else
 			TimSort(first, last);
 	}
@@ -222,18 +371,18 @@ public:
 template <class ElementType, class ContainerAllocatorSpecial, class Comparator = std::less<ElementType>>
 void runComparingTest(SortTest<ElementType, ContainerAllocatorSpecial, Comparator> test, std::string comment) {
 	std::cout << comment << "\n";
-	SortTestResult timResult = test.applyTest(SortingFunctor(false));
-	SortTestResult stdResult = test.applyTest(SortingFunctor(true));
+	SortTestResult timResult = test.applyTest(SortingFunctor(SA_TimSort));
+	SortTestResult stdResult = test.applyTest(SortingFunctor(SA_StdSort));
 	std::cout << " TimSort:\n  " << timResult.toString() << '\n';
 	std::cout << " StdSort:\n  " << stdResult.toString() << '\n';
 	std::cout << '\n';
 }
-template <class ElementType, class ContainerAllocatorSpecial, class Comparator = std::less<ElementType>>
+template <class ElementType, class ContainerAllocatorSpecial, class Comparator, class Params>
 void runComparingTest(SortTest<ElementType, ContainerAllocatorSpecial, Comparator> test,
-			const ITimSortParams& params, std::string comment) {
+			const Params& params, std::string comment) {
 	std::cout << comment << "\n";
-	SortTestResult timResult = test.applyTest(SortingFunctor(false), &params);
-	SortTestResult stdResult = test.applyTest(SortingFunctor(true));
+	SortTestResult timResult = test.applyTest(SortingFunctor(SA_TimSort), &params);
+	SortTestResult stdResult = test.applyTest(SortingFunctor(SA_StdSort));
 	std::cout << " TimSort:\n  " << timResult.toString() << '\n';
 	std::cout << " StdSort:\n  " << stdResult.toString() << '\n';
 	std::cout << '\n';
@@ -255,12 +404,32 @@ void testSimpleCases() {
 
 	runComparingTest(intArrayGenerator.nextRandomTest(0), "An empty array test");
 	runComparingTest(intVectorGenerator.nextRandomTest(0), "An empty vector test");
+
+	// std::less and std::greater on arithmetic keys sort short chunks with a sorting network,
+	// other comparators use the insertion sort. The radix fallback has the same condition, so
+	// the static comparator turns off both.
+	typedef bool (*IntComparatorPointer)(const int&, const int&);
+	SortTestGenerator<int, int (unsigned long long), VectorAllocator<int>,
+				StaticComparator<IntComparatorPointer, intComparator>>
+				insertionGenerator(717, intAllocator, TIMSORT_STATIC_COMPARATOR(intComparator));
+	SortTestGenerator<int, int (unsigned long long), VectorAllocator<int>, std::greater<int>>
+				greaterGenerator(717, intAllocator);
+	SortTestGenerator<float, float (unsigned long long), VectorAllocator<float>> floatGenerator(717, floatAllocator);
+	SortTestGenerator<unsigned long long, unsigned long long (unsigned long long),
+				VectorAllocator<unsigned long long>> uint64Generator(717, uint64Allocator);
+
+	runComparingTest(insertionGenerator.nextRandomTest(8000000), "8000000 ints in vector, no sorting network or radix sort");
+	runComparingTest(greaterGenerator.nextRandomTest(8000000), "8000000 ints in vector, descending");
+	runComparingTest(floatGenerator.nextRandomTest(8000000), "8000000 floats in vector");
+	runComparingTest(uint64Generator.nextRandomTest(8000000), "8000000 64-bit ints in vector");
+	runComparingTest(greaterGenerator.nextRandomTest(47), "47 ints in vector, descending");
 }
 
 void testTimParams() {
 	TimParams1 params1;
 	TimParams2 params2;
 	TimParamsBad paramsBad;
+	TimParamsNoBuffer paramsNoBuffer;
 
 	SortTestGenerator<double, double (unsigned long long),
 			ArrayAllocator<double>> doubleVectorGenerator(3112907, doubleAllocator);
@@ -275,17 +444,112 @@ void testTimParams() {
 	runComparingTest(smallTest, params1, "25000 doubles in vector, Params 1");
 	runComparingTest(smallTest, params2, "25000 doubles in vector, Params 2");
 	runComparingTest(smallTest, paramsBad, "25000 doubles in vector, Params bad");
+	runComparingTest(smallTest, paramsNoBuffer, "25000 doubles in vector, Params no buffer");
 	runComparingTest(smallTest, "25000 doubles in vector, Params default");
 
 	runComparingTest(mediumTest, params1, "125000 doubles in vector, Params 1");
 	runComparingTest(mediumTest, params2, "125000 doubles in vector, Params 2");
+	runComparingTest(mediumTest, paramsNoBuffer, "125000 doubles in vector, Params no buffer");
 	runComparingTest(mediumTest, "125000 doubles in vector, Params default");
 
 	runComparingTest(largeTest, params1, "1000000 doubles in vector, Params 1");
 	runComparingTest(largeTest, params2, "1000000 doubles in vector, Params 2");
+	runComparingTest(largeTest, paramsNoBuffer, "1000000 doubles in vector, Params no buffer");
 	runComparingTest(largeTest, "1000000 doubles in vector, Params default");
 }
 
+void testPolicies() {
+	DefaultTimSortParams params;
+	DefaultTimSortPolicy policy;
+
+	SortTestGenerator<int, int (unsigned long long), ArrayAllocator<int>> intArrayGenerator(717, intAllocator);
+	SortTest<int, ArrayAllocator<int>> test = intArrayGenerator.nextRandomTest(4000000);
+
+	runComparingTest(test, static_cast<const ITimSortParams&>(params), "4000000 ints in array, virtual params");
+	runComparingTest(test, policy, "4000000 ints in array, static policy");
+
+	typedef bool (*IntComparatorPointer)(const int&, const int&);
+	SortTestGenerator<int, int (unsigned long long), ArrayAllocator<int>, IntComparatorPointer>
+				pointerGenerator(717, intAllocator, intComparator);
+	SortTestGenerator<int, int (unsigned long long), ArrayAllocator<int>,
+				StaticComparator<IntComparatorPointer, intComparator>>
+				staticGenerator(717, intAllocator, TIMSORT_STATIC_COMPARATOR(intComparator));
+
+	runComparingTest(pointerGenerator.nextRandomTest(4000000), "4000000 ints in array, function pointer comparator");
+	runComparingTest(staticGenerator.nextRandomTest(4000000), "4000000 ints in array, static comparator");
+}
+
+struct KeyedElement {
+	unsigned int key;
+	unsigned int index;
+};
+
+class KeyedElementComparator {
+public:
+	bool operator ()(const KeyedElement& a, const KeyedElement& b) const {
+		return a.key < b.key;
+	}
+};
+
+void runStabilityTest(std::vector<KeyedElement> elements, const ITimSortParams& params, std::string comment,
+			TimSortThreadPool* pool = nullptr) {
+	std::cout << comment << "\n";
+
+	unsigned long long workTime = BenchmarkClock::now();
+	if (pool)
+		TimSort(elements.begin(), elements.end(), KeyedElementComparator(), params, *pool);
+	else
+		TimSort(elements.begin(), elements.end(), KeyedElementComparator(), params);
+	workTime = (BenchmarkClock::now() - workTime) / 1000000; // in ms
+
+	std::vector<unsigned int> crashIndeces;
+	for (unsigned int i = 1; i < elements.size(); ++i) {
+		const KeyedElement& a = elements[i - 1];
+		const KeyedElement& b = elements[i];
+		if (b.key < a.key || (b.key == a.key && b.index < a.index))
+			crashIndeces.push_back(i - 1);
+	}
+
+	std::cout << " TimSort:\n  " << SortTestResult(workTime, crashIndeces).toString() << "\n\n";
+}
+
+void testStability() {
+	DefaultTimSortParams paramsDefault;
+	TimParamsNoBuffer paramsNoBuffer;
+	TimParamsParallel paramsParallel;
+	PowerSortParams paramsPowerSort;
+	TimSortThreadPool pool(3);
+
+	unsigned int sizes[] {1000, 100000, 1000000};
+	unsigned int keysCounts[] {2, 100, 10000};
+
+	for (unsigned int i = 0; i < 3; ++i) {
+		for (unsigned int j = 0; j < 3; ++j) {
+			std::vector<KeyedElement> elements(sizes[i]);
+			for (unsigned int k = 0; k < sizes[i]; ++k) {
+				elements[k].key = (intAllocator(k * 7919ULL + j) * 2654435761U) % keysCounts[j];
+				elements[k].index = k;
+			}
+
+			std::basic_ostringstream<char> oStr;
+			oStr << sizes[i] << " elements with " << keysCounts[j] << " distinct keys, stability";
+			runStabilityTest(elements, paramsDefault, oStr.str() + ", Params default");
+			runStabilityTest(elements, paramsNoBuffer, oStr.str() + ", Params no buffer");
+			runStabilityTest(elements, paramsParallel, oStr.str() + ", Params parallel");
+			runStabilityTest(elements, paramsNoBuffer, oStr.str() + ", Params no buffer, shared pool", &pool);
+			runStabilityTest(elements, paramsPowerSort, oStr.str() + ", Powersort, shared pool", &pool);
+		}
+	}
+
+	// The short tail run shares keys with the long one and is merged from the high end
+	std::vector<KeyedElement> skewed(1000000);
+	for (unsigned int k = 0; k < skewed.size(); ++k) {
+		skewed[k].key = k < 990000 ? k / 3 : (intAllocator(k * 7919ULL) * 2654435761U) % 330000;
+		skewed[k].index = k;
+	}
+	runStabilityTest(skewed, paramsDefault, "1000000 elements with a short tail run, stability, Params default");
+}
+
 
 void testParitalSortedOne(const SortTestGenerator<int, int (unsigned long long),
 			ArrayAllocator<int>>& gen, unsigned int runSize, unsigned int runsCount) {
@@ -304,6 +568,48 @@ void testPartialSorted() {
 			testParitalSortedOne(intArrayGenerator, runSizes[j], runCounts[i]);
 		}
 	}
+
+	// Merges dominate: 32-bit keys take the block merge, others the branchless one
+	SortTestGenerator<unsigned long long, unsigned long long (unsigned long long),
+				ArrayAllocator<unsigned long long>> uint64Generator(29, uint64Allocator);
+	SortTestGenerator<double, double (unsigned long long), ArrayAllocator<double>> doubleGenerator(29, doubleAllocator);
+	runComparingTest(intArrayGenerator.nextRunSequenceTest(4000000, 2), "2 runs of int with length 4000000 in array");
+	runComparingTest(uint64Generator.nextRunSequenceTest(4000000, 2), "2 runs of 64-bit ints with length 4000000 in array");
+	runComparingTest(doubleGenerator.nextRunSequenceTest(4000000, 2), "2 runs of doubles with length 4000000 in array");
+}
+
+void testMergeStrategies() {
+	DefaultTimSortParams paramsDefault;
+	TimParams1 params1;
+	TimParams2 params2;
+	PowerSortParams paramsPower;
+
+	const ITimSortParams* params[] {&paramsDefault, &params1, &params2, &paramsPower};
+	const char* paramsNames[] {"Params default", "Params 1", "Params 2", "Params powersort"};
+
+	SortTestGenerator<int, int (unsigned long long), ArrayAllocator<int>> intArrayGenerator(29, intAllocator);
+
+	unsigned int runSizes[] {20, 128, 1024};
+	unsigned int runCounts[] {10, 1000, 10000};
+
+	for (unsigned int i = 0; i < 3; ++i) {
+		for (unsigned int j = 0; j < 3; ++j) {
+			SortTest<int, ArrayAllocator<int>> test = intArrayGenerator.nextRunSequenceTest(runSizes[j], runCounts[i]);
+			for (unsigned int k = 0; k < 4; ++k) {
+				std::basic_ostringstream<char> oStr;
+				oStr << runCounts[i] << " runs of int with length " << runSizes[j] << " in array, " << paramsNames[k];
+				runComparingTest(test, *params[k], oStr.str());
+			}
+		}
+	}
+
+	// A short run is merged into a long one from the high end
+	unsigned int shortRunSizes[] {10, 1000, 100000};
+	for (unsigned int i = 0; i < 3; ++i) {
+		std::basic_ostringstream<char> oStr;
+		oStr << "Run of int with length 4000000 and appended run with length " << shortRunSizes[i] << " in array";
+		runComparingTest(intArrayGenerator.nextSkewedRunsTest(4000000, shortRunSizes[i]), oStr.str());
+	}
 }
 
 void testStrings() {
@@ -323,12 +629,458 @@ void testStrings() {
 	runComparingTest(stringPointerArrayGenerator.nextRandomTest(12000), "12000 string pointers in array");
 }
 
+void runMoveOnlyTest(unsigned int size, const ITimSortParams& params, std::string comment) {
+	std::cout << comment << "\n";
+
+	std::vector<MoveOnlyInt> elements;
+	elements.reserve(size);
+	for (unsigned int i = 0; i < size; ++i)
+		elements.emplace_back(intAllocator(i * 6364136223846793005ULL + 1442695040888963407ULL));
+
+	unsigned long long workTime = BenchmarkClock::now();
+	TimSort(elements.begin(), elements.end(), params);
+	workTime = (BenchmarkClock::now() - workTime) / 1000000; // in ms
+
+	std::vector<unsigned int> crashIndeces;
+	for (unsigned int i = 1; i < size; ++i) {
+		if (elements[i] < elements[i - 1])
+			crashIndeces.push_back(i - 1);
+	}
+
+	std::cout << " TimSort:\n  " << SortTestResult(workTime, crashIndeces).toString() << "\n\n";
+}
+
+void testMoveOnly() {
+	DefaultTimSortParams paramsDefault;
+	TimParamsNoBuffer paramsNoBuffer;
+
+	runMoveOnlyTest(4000, paramsDefault, "4000 move-only ints in vector, Params default");
+	runMoveOnlyTest(4000, paramsNoBuffer, "4000 move-only ints in vector, Params no buffer");
+	runMoveOnlyTest(1000000, paramsDefault, "1000000 move-only ints in vector, Params default");
+	runMoveOnlyTest(1000000, paramsNoBuffer, "1000000 move-only ints in vector, Params no buffer");
+}
+
+void runAllocationTest(unsigned int size, const ITimSortParams& params,
+			unsigned long long maxAllocations, std::string comment) {
+	std::cout << comment << "\n";
+
+	std::vector<int> elements(size);
+	for (unsigned int i = 0; i < size; ++i)
+		elements[i] = intAllocator(i * 6364136223846793005ULL + 1442695040888963407ULL);
+
+	unsigned long long allocations = AllocationCounter::count();
+	TimSort(elements.begin(), elements.end(), params);
+	allocations = AllocationCounter::count() - allocations;
+
+	std::cout << " TimSort:\n  " << (allocations <= maxAllocations ? "Test succeed" : "Test crashed") <<
+				"; allocations: " << allocations << "\n\n";
+}
+
+void testAllocations() {
+	DefaultTimSortParams paramsDefault;
+	TimParamsNoBuffer paramsNoBuffer;
+
+	runAllocationTest(1000000, paramsNoBuffer, 0, "1000000 ints in vector, Params no buffer, allocations");
+	runAllocationTest(1000000, paramsDefault, 32, "1000000 ints in vector, Params default, allocations");
+}
+
 void testEtalones() {
 	SortTestGenerator<int, int (unsigned long long), VectorAllocator<int>> intVectorGenerator(717, intAllocator);
 	SortTestGenerator<int, int (unsigned long long), ArrayAllocator<int>> intArrayGenerator(717, intAllocator);
 
 	runComparingTest(intVectorGenerator.nextRandomTest(10000000), "10000000 random ints in vector");
 	runComparingTest(intArrayGenerator.nextRandomTest(10000000), "10000000 random ints in array");
+
+	TimParamsParallel paramsParallel;
+	runComparingTest(intVectorGenerator.nextRandomTest(10000000), paramsParallel,
+				"10000000 random ints in vector, Params parallel");
+	runComparingTest(intArrayGenerator.nextRunSequenceTest(100000, 100), paramsParallel,
+				"100 runs of int with length 100000 in array, Params parallel");
+}
+
+template <class Element, class Comparator, class KeySort>
+void runKeyTest(std::vector<Element> elements, const Comparator& comparator, const KeySort& keySort,
+			std::string comment) {
+	std::cout << comment << "\n";
+	std::vector<Element> plainElements = elements;
+
+	unsigned long long keyTime = BenchmarkClock::now();
+	keySort(elements.begin(), elements.end());
+	keyTime = (BenchmarkClock::now() - keyTime) / 1000000; // in ms
+
+	unsigned long long plainTime = BenchmarkClock::now();
+	TimSort(plainElements.begin(), plainElements.end(), comparator);
+	plainTime = (BenchmarkClock::now() - plainTime) / 1000000; // in ms
+
+	std::vector<unsigned int> keyCrashIndeces, plainCrashIndeces;
+	for (unsigned int i = 1; i < elements.size(); ++i) {
+		if (comparator(elements[i], elements[i - 1]))
+			keyCrashIndeces.push_back(i - 1);
+		if (comparator(plainElements[i], plainElements[i - 1]))
+			plainCrashIndeces.push_back(i - 1);
+	}
+
+	std::cout << " TimSort by key:\n  " << SortTestResult(keyTime, keyCrashIndeces).toString() << '\n';
+	std::cout << " TimSort:\n  " << SortTestResult(plainTime, plainCrashIndeces).toString() << "\n\n";
+}
+
+template <class Element, class KeySort>
+void runKeyStabilityTest(unsigned int size, const KeySort& keySort, std::string comment) {
+	std::cout << comment << "\n";
+
+	std::vector<Element> elements(size);
+	for (unsigned int k = 0; k < size; ++k) {
+		elements[k].key = (intAllocator(k * 7919ULL) * 2654435761U) % 1000;
+		elements[k].index = k;
+	}
+
+	unsigned long long workTime = BenchmarkClock::now();
+	keySort(elements.begin(), elements.end());
+	workTime = (BenchmarkClock::now() - workTime) / 1000000; // in ms
+
+	std::vector<unsigned int> crashIndeces;
+	for (unsigned int i = 1; i < size; ++i) {
+		const Element& a = elements[i - 1];
+		const Element& b = elements[i];
+		if (b.key < a.key || (b.key == a.key && b.index < a.index))
+			crashIndeces.push_back(i - 1);
+	}
+
+	std::cout << " TimSort by key:\n  " << SortTestResult(workTime, crashIndeces).toString() << "\n\n";
+}
+
+// Too big to travel with its key, so it is permuted after the keys are sorted
+struct BigKeyedElement {
+	unsigned int key;
+	unsigned int index;
+	std::string payload;
+};
+
+void testKeys() {
+	typedef std::vector<KeyedElement>::iterator KeyedIterator;
+	typedef std::vector<BigKeyedElement>::iterator BigKeyedIterator;
+
+	runKeyStabilityTest<KeyedElement>(1000000, [](KeyedIterator first, KeyedIterator last) {
+		TimSortByKey(first, last, &KeyedElement::key);
+	}, "1000000 elements by a member pointer, stability");
+	runKeyStabilityTest<KeyedElement>(1000000, [](KeyedIterator first, KeyedIterator last) {
+		TimSortByKey(first, last, [](const KeyedElement& e) { return e.key; });
+	}, "1000000 elements by a cached key, stability");
+	runKeyStabilityTest<BigKeyedElement>(1000000, [](BigKeyedIterator first, BigKeyedIterator last) {
+		TimSortByKey(first, last, [](const BigKeyedElement& e) { return e.key; });
+	}, "1000000 big elements by a cached key, stability");
+	runKeyStabilityTest<KeyedElement>(1000000, [](KeyedIterator first, KeyedIterator last) {
+		std::vector<uint32_t> indices = TimSortIndices<uint32_t>(first, last, KeyedElementComparator());
+		applyPermutation(first, indices.begin(), indices.end());
+	}, "1000000 elements by sorted indices, stability");
+	runKeyStabilityTest<BigKeyedElement>(1000000, [](BigKeyedIterator first, BigKeyedIterator last) {
+		std::unique_ptr<size_t[]> indices(new size_t[last - first]);
+		TimSortIndices(first, last, indices.get(), [](const BigKeyedElement& a, const BigKeyedElement& b) {
+			return a.key < b.key;
+		});
+		applyPermutation(first, indices.get(), indices.get() + (last - first));
+	}, "1000000 big elements by sorted indices in a caller buffer, stability");
+
+	Point pivot(7.35e3, 1.194e2, 6.832e-2);
+	std::vector<Point> points(1000000);
+	for (unsigned int i = 0; i < points.size(); ++i)
+		points[i] = pointAllocator(i * 6364136223846793005ULL + 1442695040888963407ULL);
+	runKeyTest(points, PointComparator(pivot), [&](std::vector<Point>::iterator first, std::vector<Point>::iterator last) {
+		TimSortByKey(first, last, PointDistance(pivot));
+	}, "1000000 3d-points in vector by a cached distance");
+
+	std::vector<std::string*> strings(12000);
+	for (unsigned int i = 0; i < strings.size(); ++i)
+		strings[i] = stringPointerAllocator(i * 6364136223846793005ULL + 1442695040888963407ULL);
+	runKeyTest(strings, StringPointerComparator(), [](std::vector<std::string*>::iterator first,
+				std::vector<std::string*>::iterator last) {
+		TimSortByPrefix(first, last, StringPrefix(), StringPointerComparator());
+	}, "12000 string pointers in vector with cached prefixes");
+	for (unsigned int i = 0; i < strings.size(); ++i)
+		delete strings[i];
+}
+
+void runPartialSortTest(std::vector<int> elements, unsigned int count, std::string comment) {
+	std::cout << comment << "\n";
+	std::vector<int> stdElements = elements;
+	std::vector<int> sortedElements = elements;
+	std::sort(sortedElements.begin(), sortedElements.end());
+
+	unsigned long long timTime = BenchmarkClock::now();
+	TimPartialSort(elements.begin(), elements.begin() + count, elements.end(), intComparator);
+	timTime = (BenchmarkClock::now() - timTime) / 1000000; // in ms
+
+	unsigned long long stdTime = BenchmarkClock::now();
+	std::partial_sort(stdElements.begin(), stdElements.begin() + count, stdElements.end(), intComparator);
+	stdTime = (BenchmarkClock::now() - stdTime) / 1000000; // in ms
+
+	std::vector<unsigned int> timCrashIndeces, stdCrashIndeces;
+	for (unsigned int i = 0; i < count; ++i) {
+		if (elements[i] != sortedElements[i])
+			timCrashIndeces.push_back(i);
+		if (stdElements[i] != sortedElements[i])
+			stdCrashIndeces.push_back(i);
+	}
+
+	std::cout << " TimSort:\n  " << SortTestResult(timTime, timCrashIndeces).toString() << '\n';
+	std::cout << " StdSort:\n  " << SortTestResult(stdTime, stdCrashIndeces).toString() << "\n\n";
+}
+
+void testPartialSort() {
+	std::vector<int> randomElements(4000000), runElements(4000000);
+	for (unsigned int i = 0; i < randomElements.size(); ++i) {
+		randomElements[i] = intAllocator(i * 6364136223846793005ULL + 1442695040888963407ULL);
+		runElements[i] = static_cast<int>(i % 100000) * 7 + randomElements[i] % 100;
+	}
+
+	runPartialSortTest(randomElements, 100, "Top 100 of 4000000 random ints");
+	runPartialSortTest(randomElements, 400000, "Top 400000 of 4000000 random ints");
+	runPartialSortTest(runElements, 400000, "Top 400000 of 40 runs of ints with length 100000");
+
+	runKeyStabilityTest<KeyedElement>(1000000, [](std::vector<KeyedElement>::iterator first,
+				std::vector<KeyedElement>::iterator last) {
+		std::vector<KeyedElement>::iterator middle = TimSortTopK(first, last, 5000, KeyedElementComparator());
+		// Only the top is checked, the rest repeats its last element
+		std::fill(middle, last, middle[-1]);
+	}, "Top 5000 of 1000000 elements, stability");
+}
+
+void runAppendTest(unsigned int sortedSize, unsigned int appendedSize, std::string comment) {
+	std::cout << comment << "\n";
+	std::vector<int> elements(sortedSize + appendedSize);
+	for (unsigned int i = 0; i < elements.size(); ++i)
+		elements[i] = intAllocator(i * 6364136223846793005ULL + 1442695040888963407ULL);
+	std::sort(elements.begin(), elements.begin() + sortedSize);
+	std::vector<int> plainElements = elements;
+
+	unsigned long long appendTime = BenchmarkClock::now();
+	TimSortAppend(elements.begin(), elements.begin() + sortedSize, elements.end(), intComparator);
+	appendTime = (BenchmarkClock::now() - appendTime) / 1000000; // in ms
+
+	unsigned long long plainTime = BenchmarkClock::now();
+	TimSort(plainElements.begin(), plainElements.end(), intComparator);
+	plainTime = (BenchmarkClock::now() - plainTime) / 1000000; // in ms
+
+	std::vector<unsigned int> appendCrashIndeces, plainCrashIndeces;
+	for (unsigned int i = 1; i < elements.size(); ++i) {
+		if (elements[i] < elements[i - 1])
+			appendCrashIndeces.push_back(i - 1);
+		if (plainElements[i] < plainElements[i - 1])
+			plainCrashIndeces.push_back(i - 1);
+	}
+
+	std::cout << " TimSort append:\n  " << SortTestResult(appendTime, appendCrashIndeces).toString() << '\n';
+	std::cout << " TimSort:\n  " << SortTestResult(plainTime, plainCrashIndeces).toString() << "\n\n";
+}
+
+void testAppend() {
+	runAppendTest(4000000, 1000, "1000 ints appended to 4000000 sorted ints");
+	runAppendTest(4000000, 400000, "400000 ints appended to 4000000 sorted ints");
+	runAppendTest(0, 400000, "400000 ints appended to nothing");
+
+	runKeyStabilityTest<KeyedElement>(1000000, [](std::vector<KeyedElement>::iterator first,
+				std::vector<KeyedElement>::iterator last) {
+		std::vector<KeyedElement>::iterator sortedEnd = first + (last - first) * 3 / 4;
+		TimSort(first, sortedEnd, KeyedElementComparator());
+		TimSortAppend(first, sortedEnd, last, KeyedElementComparator());
+	}, "250000 elements appended to 750000 sorted elements, stability");
+}
+
+template <class Params>
+void runMergeKTest(std::vector<int> elements, unsigned int runSize, const Params& params, std::string comment) {
+	std::cout << comment << "\n";
+	std::vector<std::pair<std::vector<int>::const_iterator, std::vector<int>::const_iterator>> ranges;
+	std::vector<std::vector<int>::iterator> bounds;
+	for (unsigned int i = 0; i < elements.size(); i += runSize) {
+		unsigned int runEnd = std::min<unsigned int>(i + runSize, elements.size());
+		std::sort(elements.begin() + i, elements.begin() + runEnd);
+		ranges.push_back(std::make_pair(elements.cbegin() + i, elements.cbegin() + runEnd));
+		if (i > 0)
+			bounds.push_back(elements.begin() + i);
+	}
+	std::vector<int> mergedElements(elements.size());
+	std::vector<int> plainElements = elements;
+
+	unsigned long long mergeTime = BenchmarkClock::now();
+	TimSortMergeK(ranges, mergedElements.begin(), intComparator, params);
+	mergeTime = (BenchmarkClock::now() - mergeTime) / 1000000; // in ms
+
+	unsigned long long inplaceTime = BenchmarkClock::now();
+	TimSortMergeKInPlace(elements.begin(), elements.end(), bounds, intComparator, params);
+	inplaceTime = (BenchmarkClock::now() - inplaceTime) / 1000000; // in ms
+
+	unsigned long long plainTime = BenchmarkClock::now();
+	TimSort(plainElements.begin(), plainElements.end(), intComparator, params);
+	plainTime = (BenchmarkClock::now() - plainTime) / 1000000; // in ms
+
+	std::vector<unsigned int> mergeCrashIndeces, inplaceCrashIndeces, plainCrashIndeces;
+	for (unsigned int i = 0; i < elements.size(); ++i) {
+		if (mergedElements[i] != plainElements[i])
+			mergeCrashIndeces.push_back(i);
+		if (elements[i] != plainElements[i])
+			inplaceCrashIndeces.push_back(i);
+		if (i > 0 && plainElements[i] < plainElements[i - 1])
+			plainCrashIndeces.push_back(i - 1);
+	}
+
+	std::cout << " TimSort k-way merge:\n  " << SortTestResult(mergeTime, mergeCrashIndeces).toString() << '\n';
+	std::cout << " TimSort k-way merge in place:\n  " <<
+				SortTestResult(inplaceTime, inplaceCrashIndeces).toString() << '\n';
+	std::cout << " TimSort:\n  " << SortTestResult(plainTime, plainCrashIndeces).toString() << "\n\n";
+}
+
+void testMergeK() {
+	DefaultTimSortParams paramsDefault;
+	TimParamsSmallBuffer paramsSmallBuffer;
+	TimParamsNoBuffer paramsNoBuffer;
+
+	std::vector<int> randomElements(4000000), skewedElements(4000000);
+	for (unsigned int i = 0; i < randomElements.size(); ++i) {
+		randomElements[i] = intAllocator(i * 6364136223846793005ULL + 1442695040888963407ULL);
+		// Every run covers its own range of values but a few outliers
+		skewedElements[i] = i % 97 == 0 ? randomElements[i] : static_cast<int>(i / 10000) * 10000 + i % 10000;
+	}
+
+	runMergeKTest(randomElements, 10000, paramsDefault, "400 runs of ints with length 10000, merged at once");
+	runMergeKTest(randomElements, 1000, paramsDefault, "4000 runs of ints with length 1000, merged at once");
+	runMergeKTest(skewedElements, 10000, paramsDefault, "400 runs of ints with length 10000 in their own ranges");
+	runMergeKTest(randomElements, 10000, paramsSmallBuffer,
+				"400 runs of ints with length 10000, merged at once, Params with 1 MB buffer");
+	runMergeKTest(randomElements, 10000, paramsNoBuffer,
+				"400 runs of ints with length 10000, merged at once, Params without buffer");
+	runMergeKTest(std::vector<int>(randomElements.begin(), randomElements.begin() + 100), 7, paramsDefault,
+				"15 runs of ints with length 7, merged at once");
+
+	runKeyStabilityTest<KeyedElement>(1000000, [](std::vector<KeyedElement>::iterator first,
+				std::vector<KeyedElement>::iterator last) {
+		std::vector<std::vector<KeyedElement>::iterator> bounds;
+		for (std::vector<KeyedElement>::iterator it = first; it < last; it += 3000) {
+			TimSort(it, std::min(it + 3000, last), KeyedElementComparator());
+			bounds.push_back(it);
+		}
+		TimSortMergeKInPlace(first, last, bounds, KeyedElementComparator(), TimParamsSmallBuffer());
+	}, "334 runs of elements with length 3000, merged at once in place, stability");
+	runKeyStabilityTest<KeyedElement>(1000000, [](std::vector<KeyedElement>::iterator first,
+				std::vector<KeyedElement>::iterator last) {
+		std::vector<std::pair<std::vector<KeyedElement>::iterator, std::vector<KeyedElement>::iterator>> ranges;
+		for (std::vector<KeyedElement>::iterator it = first; it < last; it += 3000) {
+			ranges.push_back(std::make_pair(it, std::min(it + 3000, last)));
+			TimSort(ranges.back().first, ranges.back().second, KeyedElementComparator());
+		}
+		std::vector<KeyedElement> merged(last - first);
+		TimSortMergeK(ranges, merged.begin(), KeyedElementComparator());
+		std::copy(merged.begin(), merged.end(), first);
+	}, "334 runs of elements with length 3000, merged at once, stability");
+}
+
+// Records of width bytes hold their index at 0 and a u32 key at keyOffset
+void runRecordsTest(unsigned int size, size_t width, size_t keyOffset, std::string comment) {
+	std::cout << comment << "\n";
+	std::vector<unsigned char> records(size * width, 0xAB);
+	for (unsigned int k = 0; k < size; ++k) {
+		unsigned int key = (intAllocator(k * 7919ULL) * 2654435761U) % 1000;
+		std::memcpy(&records[k * width], &k, sizeof(k));
+		std::memcpy(&records[k * width + keyOffset], &key, sizeof(key));
+	}
+
+	RecordIterator first(records.data(), width);
+	unsigned long long workTime = BenchmarkClock::now();
+	TimSort(first, first + size, RecordKeyComparator<unsigned int>(keyOffset));
+	workTime = (BenchmarkClock::now() - workTime) / 1000000; // in ms
+
+	std::vector<unsigned int> crashIndeces;
+	for (unsigned int i = 1; i < size; ++i) {
+		unsigned int indexA, indexB, keyA, keyB;
+		std::memcpy(&indexA, &records[(i - 1) * width], sizeof(indexA));
+		std::memcpy(&indexB, &records[i * width], sizeof(indexB));
+		std::memcpy(&keyA, &records[(i - 1) * width + keyOffset], sizeof(keyA));
+		std::memcpy(&keyB, &records[i * width + keyOffset], sizeof(keyB));
+		if (keyB < keyA || (keyB == keyA && indexB < indexA) || records[i * width + width - 1] != 0xAB)
+			crashIndeces.push_back(i - 1);
+	}
+
+	std::cout << " TimSort records:\n  " << SortTestResult(workTime, crashIndeces).toString() << "\n\n";
+}
+
+void testRecords() {
+	runRecordsTest(1000000, 12, 4, "1000000 records of 12 bytes, stability");
+	runRecordsTest(100000, 100, 37, "100000 records of 100 bytes, key not aligned, stability");
+}
+
+void runExternalTest(const std::vector<KeyedElement>& elements, size_t memoryBudget, std::string comment) {
+	std::cout << comment << "\n";
+	const std::string inputPath = "timsort-external-test.bin";
+	const std::string outputPath = "timsort-external-test.sorted.bin";
+
+	FILE* input = std::fopen(inputPath.c_str(), "wb");
+	std::fwrite(elements.data(), sizeof(KeyedElement), elements.size(), input);
+	std::fclose(input);
+
+	unsigned long long workTime = BenchmarkClock::now();
+	bool success = TimSortFile<KeyedElement>(inputPath, outputPath, KeyedElementComparator(), memoryBudget);
+	workTime = (BenchmarkClock::now() - workTime) / 1000000; // in ms
+
+	std::vector<KeyedElement> sorted(elements.size() + 1);
+	FILE* output = std::fopen(outputPath.c_str(), "rb");
+	size_t count = output != nullptr ? std::fread(sorted.data(), sizeof(KeyedElement), sorted.size(), output) : 0;
+	if (output != nullptr)
+		std::fclose(output);
+	std::remove(inputPath.c_str());
+	std::remove(outputPath.c_str());
+
+	std::vector<unsigned int> crashIndeces;
+	if (!success || count != elements.size())
+		crashIndeces.push_back(0);
+	for (unsigned int i = 1; i < count; ++i) {
+		const KeyedElement& a = sorted[i - 1];
+		const KeyedElement& b = sorted[i];
+		if (b.key < a.key || (b.key == a.key && b.index < a.index))
+			crashIndeces.push_back(i - 1);
+	}
+
+	std::cout << " TimSort external:\n  " << SortTestResult(workTime, crashIndeces).toString() << "\n\n";
+}
+
+// The output path is a directory: the sort must fail and remove the run files made next to it
+void testExternalUnwritableOutput(const std::vector<KeyedElement>& elements) {
+	std::cout << "4000000 elements in a file, output can't be opened\n";
+	const std::string inputPath = "timsort-external-test.bin";
+	const std::string outputPath = ".";
+
+	FILE* input = std::fopen(inputPath.c_str(), "wb");
+	std::fwrite(elements.data(), sizeof(KeyedElement), elements.size(), input);
+	std::fclose(input);
+
+	unsigned long long workTime = BenchmarkClock::now();
+	bool success = TimSortFile<KeyedElement>(inputPath, outputPath, KeyedElementComparator(), 8 << 20);
+	workTime = (BenchmarkClock::now() - workTime) / 1000000; // in ms
+	std::remove(inputPath.c_str());
+
+	std::vector<unsigned int> crashIndeces;
+	if (success)
+		crashIndeces.push_back(0);
+	FILE* run = std::fopen((outputPath + ".run0").c_str(), "rb");
+	if (run != nullptr) {
+		std::fclose(run);
+		crashIndeces.push_back(1);
+	}
+
+	std::cout << " TimSort external:\n  " << SortTestResult(workTime, crashIndeces).toString() << "\n\n";
+}
+
+void testExternal() {
+	std::vector<KeyedElement> randomElements(4000000), runElements(4000000);
+	for (unsigned int k = 0; k < randomElements.size(); ++k) {
+		randomElements[k].key = (intAllocator(k * 7919ULL) * 2654435761U) % 100000;
+		randomElements[k].index = k;
+		runElements[k].key = k % 100000 + randomElements[k].key % 16;
+		runElements[k].index = k;
+	}
+
+	runExternalTest(randomElements, 64 << 20, "4000000 elements in a file, 64 MB of memory");
+	runExternalTest(randomElements, 8 << 20, "4000000 elements in a file, 8 MB of memory");
+	runExternalTest(runElements, 8 << 20, "40 runs of elements with length 100000 in a file, 8 MB of memory");
+	testExternalUnwritableOutput(randomElements);
 }
 
 void testPoints() {
@@ -341,12 +1093,130 @@ void testPoints() {
 				"1000 runs of 3d-points with length 1000 in array");
 }
 
-int main() {
+// Counters of the phases since TimSortProfiler::reset, per sort; empty without TIMSORT_PROFILE
+std::vector<BenchmarkPhase> profiledPhases(unsigned int sortsCount) {
+	std::vector<BenchmarkPhase> phases;
+	if (!TimSortProfiler::available())
+		return phases;
+
+	for (unsigned int p = 0; p < TP_PhasesCount; ++p) {
+		TimSortPhaseCounters counters = TimSortProfiler::counters(static_cast<ETimSortPhase>(p));
+		BenchmarkPhase phase;
+		phase.name = timSortPhaseName(static_cast<ETimSortPhase>(p));
+		phase.cycles = static_cast<double>(counters.values[TC_Cycles]) / sortsCount;
+		phase.instructions = static_cast<double>(counters.values[TC_Instructions]) / sortsCount;
+		phase.branchMisses = static_cast<double>(counters.values[TC_BranchMisses]) / sortsCount;
+		phase.llcMisses = static_cast<double>(counters.values[TC_LlcMisses]) / sortsCount;
+		phases.push_back(phase);
+	}
+	return phases;
+}
+
+template <class ElementType, class ContainerAllocatorSpecial, class Comparator>
+void runBenchmarkCase(SortTest<ElementType, ContainerAllocatorSpecial, Comparator> test, std::string caseName,
+			const BenchmarkOptions& options, BenchmarkReport& report) {
+	// The warmups are counted too, the phases are averaged over all sorts
+	TimSortProfiler::reset();
+	BenchmarkResult timResult = test.applyBenchmark(caseName, "TimSort", SortingFunctor(SA_TimSort), options);
+	timResult.phases = profiledPhases(options.warmups + options.repetitions);
+	report.add(timResult);
+	report.add(test.applyBenchmark(caseName, "std::sort", SortingFunctor(SA_StdSort), options));
+	report.add(test.applyBenchmark(caseName, "std::stable_sort", SortingFunctor(SA_StdStableSort), options));
+}
+
+void benchmarkSorts(const BenchmarkOptions& options, BenchmarkReport& report) {
+	SortTestGenerator<int, int (unsigned long long), VectorAllocator<int>> intVectorGenerator(717, intAllocator);
+	SortTestGenerator<double, double (unsigned long long), VectorAllocator<double>> doubleGenerator(717, doubleAllocator);
+	SortTestGenerator<std::string, std::string (unsigned long long), VectorAllocator<std::string>>
+				stringGenerator(2514, stringAllocator);
+	PointComparator pointComparator(Point(7.35e3, 1.194e2, 6.832e-2));
+	SortTestGenerator<Point, Point (unsigned long long), VectorAllocator<Point>, PointComparator>
+				pointGenerator(72514, pointAllocator, pointComparator);
+
+	runBenchmarkCase(intVectorGenerator.nextRandomTest(1000), "1000 random ints", options, report);
+	runBenchmarkCase(intVectorGenerator.nextRandomTest(1000000), "1000000 random ints", options, report);
+	runBenchmarkCase(intVectorGenerator.nextRunSequenceTest(10000, 100), "100 runs of ints with length 10000",
+				options, report);
+	runBenchmarkCase(intVectorGenerator.nextSkewedRunsTest(1000000, 1000),
+				"Runs of ints with lengths 1000000 and 1000", options, report);
+	runBenchmarkCase(doubleGenerator.nextRandomTest(1000000), "1000000 random doubles", options, report);
+	runBenchmarkCase(stringGenerator.nextRandomTest(4000), "4000 random strings", options, report);
+	runBenchmarkCase(pointGenerator.nextRandomTest(200000), "200000 random 3d-points", options, report);
+}
+
+// timsort-test --benchmark [--warmups N] [--repetitions N] [--csv FILE] [--json FILE];
+// built with TIMSORT_PROFILE, TimSort results get hardware counters of every phase
+int runBenchmarks(int argc, char** argv) {
+	BenchmarkOptions options;
+	std::string csvPath, jsonPath;
+	for (int i = 0; i < argc; i += 2) {
+		std::string option = argv[i];
+		if (i + 1 == argc) {
+			std::cerr << "No value for " << option << '\n';
+			return 2;
+		}
+
+		if (option == "--warmups") {
+			options.warmups = static_cast<unsigned int>(std::strtoul(argv[i + 1], nullptr, 10));
+		} else if (option == "--repetitions") {
+			options.repetitions = static_cast<unsigned int>(std::strtoul(argv[i + 1], nullptr, 10));
+		} else if (option == "--csv") {
+			csvPath = argv[i + 1];
+		} else if (option == "--json") {
+			jsonPath = argv[i + 1];
+		} else {
+			std::cerr << "Unknown option " << option << '\n';
+			return 2;
+		}
+	}
+	if (options.repetitions == 0) {
+		std::cerr << "At least one repetition is needed\n";
+		return 2;
+	}
+
+	BenchmarkReport report;
+	benchmarkSorts(options, report);
+	report.writeText(std::cout);
+
+	if (!csvPath.empty()) {
+		std::ofstream csv(csvPath.c_str());
+		report.writeCsv(csv);
+		if (!csv) {
+			std::cerr << "Can't write " << csvPath << '\n';
+			return 1;
+		}
+	}
+	if (!jsonPath.empty()) {
+		std::ofstream json(jsonPath.c_str());
+		report.writeJson(json);
+		if (!json) {
+			std::cerr << "Can't write " << jsonPath << '\n';
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	if (argc > 1 && std::string(argv[1]) == "--benchmark")
+		return runBenchmarks(argc - 2, argv + 2);
+
 	testEtalones();
 	testSimpleCases();
 	testPartialSorted();
+	testMergeStrategies();
 	testTimParams();
+	testPolicies();
+	testStability();
 	testStrings();
+	testMoveOnly();
+	testAllocations();
+	testKeys();
+	testPartialSort();
+	testAppend();
+	testMergeK();
+	testRecords();
+	testExternal();
 	testPoints();
 
 	return 0;
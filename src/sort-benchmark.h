@@ -0,0 +1,189 @@
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <ostream>
+
+
+// Monotonic wall clock time in nanoseconds
+class BenchmarkClock {
+public:
+	static unsigned long long now() {
+		return static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+};
+
+class BenchmarkOptions {
+public:
+	unsigned int warmups;
+	unsigned int repetitions;
+
+	BenchmarkOptions()
+		:warmups(2), repetitions(11)
+	{}
+};
+
+// Summary of the timed repetitions of one sort, in nanoseconds
+class BenchmarkStats {
+public:
+	double min, median, p90, mean, stddev;
+
+	explicit BenchmarkStats(std::vector<double> samples)
+		:min(0), median(0), p90(0), mean(0), stddev(0) {
+		if (samples.empty())
+			return;
+
+		std::sort(samples.begin(), samples.end());
+		min = samples.front();
+		median = percentile(samples, 0.5);
+		p90 = percentile(samples, 0.9);
+
+		for (size_t i = 0; i < samples.size(); ++i)
+			mean += samples[i];
+		mean /= samples.size();
+		for (size_t i = 0; i < samples.size(); ++i)
+			stddev += (samples[i] - mean) * (samples[i] - mean);
+		stddev = samples.size() > 1 ? std::sqrt(stddev / (samples.size() - 1)) : 0;
+	}
+
+private:
+	// Linear interpolation between the closest ranks of sorted samples
+	static double percentile(const std::vector<double>& sorted, double p) {
+		double rank = p * (sorted.size() - 1);
+		size_t lower = static_cast<size_t>(rank);
+		size_t upper = std::min(lower + 1, sorted.size() - 1);
+		return sorted[lower] + (sorted[upper] - sorted[lower]) * (rank - lower);
+	}
+};
+
+// Hardware counters of one phase of a sort, averaged over the sorts of a benchmark
+class BenchmarkPhase {
+public:
+	std::string name;
+	double cycles, instructions, branchMisses, llcMisses;
+};
+
+class BenchmarkResult {
+public:
+	const std::string caseName, algorithm;
+	const size_t elements, bytes;
+	const BenchmarkStats stats;
+	const bool success;
+	std::vector<BenchmarkPhase> phases;
+
+	BenchmarkResult(const std::string& caseName, const std::string& algorithm, size_t elements, size_t bytes,
+			const BenchmarkStats& stats, bool success)
+		:caseName(caseName), algorithm(algorithm), elements(elements), bytes(bytes), stats(stats), success(success)
+	{}
+
+	// Throughput at the median time
+	double elementsPerSecond() const {
+		return stats.median > 0 ? elements * 1e9 / stats.median : 0;
+	}
+	double bytesPerSecond() const {
+		return stats.median > 0 ? bytes * 1e9 / stats.median : 0;
+	}
+};
+
+class BenchmarkReport {
+private:
+	std::vector<BenchmarkResult> results;
+
+	// CSV doubles the quotes inside a field
+	static std::string csvQuoted(const std::string& s) {
+		std::string res = "\"";
+		for (size_t i = 0; i < s.size(); ++i)
+			res += s[i] == '"' ? std::string("\"\"") : std::string(1, s[i]);
+		return res + '"';
+	}
+
+	// Control characters are written as \u00XX, JSON doesn't allow them raw
+	static std::string jsonQuoted(const std::string& s) {
+		static const char hexDigits[] = "0123456789abcdef";
+		std::string res = "\"";
+		for (size_t i = 0; i < s.size(); ++i) {
+			unsigned char c = static_cast<unsigned char>(s[i]);
+			if (c < 0x20) {
+				res += "\\u00";
+				res += hexDigits[c >> 4];
+				res += hexDigits[c & 0xf];
+				continue;
+			}
+			if (c == '"' || c == '\\')
+				res += '\\';
+			res += s[i];
+		}
+		return res + '"';
+	}
+
+public:
+	void add(const BenchmarkResult& result) {
+		results.push_back(result);
+	}
+
+	// Times in ms
+	void writeText(std::ostream& out) const {
+		std::string lastCase;
+		for (size_t i = 0; i < results.size(); ++i) {
+			const BenchmarkResult& r = results[i];
+			if (r.caseName != lastCase)
+				out << (i > 0 ? "\n" : "") << r.caseName << '\n';
+			lastCase = r.caseName;
+
+			out << "  " << r.algorithm << (r.success ? "" : " (WRONG ORDER)") << ": median " << r.stats.median / 1e6 <<
+						" ms, p90 " << r.stats.p90 / 1e6 << " ms, stddev " << r.stats.stddev / 1e6 <<
+						" ms, " << r.elementsPerSecond() / 1e6 << " M elements/s\n";
+			for (size_t j = 0; j < r.phases.size(); ++j) {
+				const BenchmarkPhase& phase = r.phases[j];
+				out << "    " << phase.name << ": " << phase.cycles / 1e6 << " M cycles, " <<
+							(phase.cycles > 0 ? phase.instructions / phase.cycles : 0) << " IPC, " <<
+							phase.branchMisses / 1e3 << " K branch misses, " << phase.llcMisses / 1e3 << " K LLC misses\n";
+			}
+		}
+	}
+
+	void writeCsv(std::ostream& out) const {
+		std::streamsize precision = out.precision(15);
+		out << "case,algorithm,elements,bytes,min_ns,median_ns,p90_ns,mean_ns,stddev_ns,"
+					"elements_per_s,bytes_per_s,success\n";
+		for (size_t i = 0; i < results.size(); ++i) {
+			const BenchmarkResult& r = results[i];
+			out << csvQuoted(r.caseName) << ',' << csvQuoted(r.algorithm) << ',' <<
+						r.elements << ',' << r.bytes << ',' << r.stats.min << ',' << r.stats.median << ',' <<
+						r.stats.p90 << ',' << r.stats.mean << ',' << r.stats.stddev << ',' <<
+						r.elementsPerSecond() << ',' << r.bytesPerSecond() << ',' << (r.success ? 1 : 0) << '\n';
+		}
+		out.precision(precision);
+	}
+
+	void writeJson(std::ostream& out) const {
+		std::streamsize precision = out.precision(15);
+		out << "[\n";
+		for (size_t i = 0; i < results.size(); ++i) {
+			const BenchmarkResult& r = results[i];
+			out << "  {\"case\": " << jsonQuoted(r.caseName) << ", \"algorithm\": " <<
+						jsonQuoted(r.algorithm) << ", \"elements\": " << r.elements <<
+						", \"bytes\": " << r.bytes << ", \"min_ns\": " << r.stats.min <<
+						", \"median_ns\": " << r.stats.median << ", \"p90_ns\": " << r.stats.p90 <<
+						", \"mean_ns\": " << r.stats.mean << ", \"stddev_ns\": " << r.stats.stddev <<
+						", \"elements_per_s\": " << r.elementsPerSecond() <<
+						", \"bytes_per_s\": " << r.bytesPerSecond() <<
+						", \"success\": " << (r.success ? "true" : "false");
+			if (!r.phases.empty()) {
+				out << ", \"phases\": [";
+				for (size_t j = 0; j < r.phases.size(); ++j) {
+					const BenchmarkPhase& phase = r.phases[j];
+					out << (j > 0 ? ", " : "") << "{\"phase\": " << jsonQuoted(phase.name) <<
+								", \"cycles\": " << phase.cycles << ", \"instructions\": " << phase.instructions <<
+								", \"branch_misses\": " << phase.branchMisses << ", \"llc_misses\": " << phase.llcMisses << '}';
+				}
+				out << ']';
+			}
+			out << '}' << (i + 1 < results.size() ? ",\n" : "\n");
+		}
+		out << "]\n";
+		out.precision(precision);
+	}
+};
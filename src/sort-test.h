@@ -2,7 +2,19 @@
 #include <functional>
 #include <string>
 #include <sstream>
+#include <atomic>
 
+#include "sort-benchmark.h"
+
+
+// Incremented by the global operator new replacement of the test binary
+class AllocationCounter {
+public:
+	static std::atomic<unsigned long long>& count() {
+		static std::atomic<unsigned long long> value(0);
+		return value;
+	}
+};
 
 class SortTestResult {
 public:
@@ -56,17 +68,40 @@ public:
 	SortTestResult applyTest(const SortAlgorithm& sorter, const Params* params = nullptr) {
 		ContainerAllocator<ElementType, IteratorType>* const allocator = allocateInstance();
 
-		unsigned long long workTime = clock();
+		unsigned long long workTime = BenchmarkClock::now();
 
 		runSort(allocator->begin(), allocator->end(), sorter, params);
 
-		workTime = (clock() - workTime) * 1000L / CLOCKS_PER_SEC; // in ms
+		workTime = (BenchmarkClock::now() - workTime) / 1000000; // in ms
 		std::vector<unsigned int> crashIndeces = findCrashIndeces(allocator->begin(), allocator->end());
 
 		delete allocator;
 		return SortTestResult(workTime, crashIndeces);
 	}
 
+	// Every repetition sorts a fresh copy of the elements; only the sort itself is timed.
+	// The warmups are not timed, success tells whether every repetition sorted the elements.
+	template <class SortAlgorithm, class Params = void>
+	BenchmarkResult applyBenchmark(const std::string& caseName, const std::string& algorithm,
+			const SortAlgorithm& sorter, const BenchmarkOptions& options, const Params* params = nullptr) {
+		std::vector<double> samples;
+		bool success = true;
+		for (unsigned int i = 0; i < options.warmups + options.repetitions; ++i) {
+			ContainerAllocator<ElementType, IteratorType>* const allocator = allocateInstance();
+
+			unsigned long long workTime = BenchmarkClock::now();
+			runSort(allocator->begin(), allocator->end(), sorter, params);
+			workTime = BenchmarkClock::now() - workTime;
+
+			if (i >= options.warmups)
+				samples.push_back(static_cast<double>(workTime));
+			success = success && findCrashIndeces(allocator->begin(), allocator->end()).empty();
+			delete allocator;
+		}
+
+		return BenchmarkResult(caseName, algorithm, size, size * sizeof(ElementType), BenchmarkStats(samples), success);
+	}
+
 	ContainerAllocator<ElementType, IteratorType>* const allocateInstance() const {
 		return new ContainerAllocatorSpecial(elements);
 	}
@@ -200,6 +235,23 @@ public:
 		delete[] els;
 		return test;
 	}
+
+	const SortTest<ElementType, ContainerAllocatorSpecial, Comparator>
+			nextSkewedRunsTest(unsigned int longRunSize, unsigned int shortRunSize) const {
+		unsigned int size = longRunSize + shortRunSize;
+
+		ElementType* els = new ElementType[size];
+		for (unsigned int i = 0; i < size; ++i) {
+			els[i] = elementCreator(nextRandom());
+		}
+
+		std::sort(els, els + longRunSize, comparator);
+		std::sort(els + longRunSize, els + size, comparator);
+
+		SortTest<ElementType, ContainerAllocatorSpecial, Comparator> test(els, size, comparator);
+		delete[] els;
+		return test;
+	}
 };
 
 
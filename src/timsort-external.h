@@ -0,0 +1,404 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+
+
+// Records are read with two blocks: while one is consumed, the next one is read by another
+// thread. The reader owns the file.
+template <class Record>
+class RecordReader {
+private:
+	static const size_t READ_ERROR = static_cast<size_t>(-1);
+
+	FILE* file;
+	std::vector<Record> blocks[2];
+	std::future<size_t> nextRead;
+	unsigned int current;
+	size_t position, count;
+	bool failed;
+
+	RecordReader(const RecordReader&);
+	RecordReader& operator =(const RecordReader&);
+
+	static size_t readRecords(FILE* file, Record* target, size_t size) {
+		size_t bytes = std::fread(target, 1, size * sizeof(Record), file);
+		if (std::ferror(file) || bytes % sizeof(Record) != 0)
+			return READ_ERROR;
+		return bytes / sizeof(Record);
+	}
+
+	void readAhead() {
+		FILE* source = file;
+		Record* target = blocks[current ^ 1].data();
+		size_t size = blocks[current ^ 1].size();
+		nextRead = std::async(std::launch::async, [=]() {
+			return readRecords(source, target, size);
+		});
+	}
+
+	void nextBlock() {
+		count = nextRead.get();
+		position = 0;
+		current ^= 1;
+		if (count == READ_ERROR) {
+			failed = true;
+			count = 0;
+		} else if (count > 0) {
+			readAhead();
+		}
+	}
+
+public:
+	RecordReader(FILE* file, size_t blockSize)
+		:file(file), current(0), position(0), count(0), failed(file == nullptr) {
+		if (failed)
+			return;
+
+		blocks[0].resize(blockSize);
+		blocks[1].resize(blockSize);
+		readAhead();
+		nextBlock();
+	}
+
+	bool empty() const {
+		return position == count;
+	}
+
+	const Record& front() const {
+		return blocks[current][position];
+	}
+
+	void pop() {
+		if (++position == count)
+			nextBlock();
+	}
+
+	bool good() const {
+		return !failed;
+	}
+
+	~RecordReader() {
+		if (nextRead.valid())
+			nextRead.wait();
+		if (file != nullptr)
+			std::fclose(file);
+	}
+};
+
+
+// Records are collected in one block while the other one is written by another thread.
+// The writer owns the file; close() tells whether everything was written.
+template <class Record>
+class RecordWriter {
+private:
+	FILE* file;
+	std::vector<Record> blocks[2];
+	std::future<bool> lastWrite;
+	unsigned int current;
+	size_t count;
+	bool failed;
+
+	RecordWriter(const RecordWriter&);
+	RecordWriter& operator =(const RecordWriter&);
+
+	void waitWrite() {
+		if (lastWrite.valid() && !lastWrite.get())
+			failed = true;
+	}
+
+	void flush() {
+		waitWrite();
+		if (count == 0 || file == nullptr)
+			return;
+
+		FILE* target = file;
+		const Record* source = blocks[current].data();
+		size_t size = count;
+		lastWrite = std::async(std::launch::async, [=]() {
+			return std::fwrite(source, sizeof(Record), size, target) == size;
+		});
+		current ^= 1;
+		count = 0;
+	}
+
+public:
+	RecordWriter(FILE* file, size_t blockSize)
+		:file(file), current(0), count(0), failed(file == nullptr) {
+		blocks[0].resize(blockSize);
+		blocks[1].resize(blockSize);
+	}
+
+	void push(const Record& record) {
+		blocks[current][count++] = record;
+		if (count == blocks[current].size())
+			flush();
+	}
+
+	bool good() const {
+		return !failed;
+	}
+
+	bool close() {
+		if (file == nullptr)
+			return !failed;
+
+		flush();
+		waitWrite();
+		if (std::fclose(file) != 0)
+			failed = true;
+		file = nullptr;
+		return !failed;
+	}
+
+	~RecordWriter() {
+		close();
+	}
+};
+
+
+// Sorts a file of fixed-width records that may not fit in memory:
+// 1. The file is read by chunks, every chunk is sorted by TimSort while the next one is read.
+//    A sorted chunk goes to a run file, and the part of it that continues the previous run in
+//    order is appended to that run, so presorted input gives few runs.
+// 2. Run files are merged k at a time, stably, until one is left; every run and the output
+//    are read and written by large blocks with double buffering.
+// Run files are written next to the output and removed after they are merged.
+template <class Record, class Comparator>
+class ExternalSortController {
+private:
+	static_assert(std::is_trivially_copyable<Record>::value, "records are read and written as bytes");
+
+	// Chunks are sorted with a merge buffer of the chunk size at most
+	class ChunkPolicy: public DefaultTimSortPolicy {
+	private:
+		size_t budget;
+
+	public:
+		ChunkPolicy(size_t budget)
+			:budget(budget)
+		{}
+
+		size_t GetBufferBudget() const {
+			return budget;
+		}
+	};
+
+	static const size_t MIN_BLOCK_SIZE = 1 << 20; // in bytes
+	static const unsigned int MAX_MERGE_WAYS = 256;
+
+	const std::string inputPath, outputPath;
+	const Comparator comparator;
+	const size_t memoryBudget;
+	unsigned int runFilesCount;
+	std::vector<std::string> runs;
+
+	ExternalSortController(const std::string& inputPath, const std::string& outputPath,
+			const Comparator& comparator, size_t memoryBudget)
+		:inputPath(inputPath), outputPath(outputPath), comparator(comparator),
+		 memoryBudget(memoryBudget), runFilesCount(0) {}
+
+	std::string nextRunPath() {
+		return outputPath + ".run" + std::to_string(runFilesCount++);
+	}
+
+	// Two chunks and the merge buffer of one share the budget
+	bool makeRuns() {
+		size_t chunkSize = std::max<size_t>(1, memoryBudget / (3 * sizeof(Record)));
+		std::vector<Record> chunks[2] = {std::vector<Record>(chunkSize), std::vector<Record>(chunkSize)};
+
+		FILE* input = std::fopen(inputPath.c_str(), "rb");
+		if (input == nullptr)
+			return false;
+
+		std::future<size_t> nextRead = readChunk(input, chunks[0]);
+		std::future<bool> lastWrite;
+		FILE* openRun = nullptr;
+		Record openRunLast = Record();
+		bool success = true;
+
+		for (unsigned int current = 0; ; current ^= 1) {
+			size_t count = nextRead.get();
+			if (lastWrite.valid() && !lastWrite.get())
+				success = false;
+			if (count == static_cast<size_t>(-1) || !success) {
+				success = false;
+				break;
+			}
+			if (count == 0)
+				break;
+
+			nextRead = readChunk(input, chunks[current ^ 1]);
+
+			Record* chunk = chunks[current].data();
+			TimSortController<Record*, Comparator, ChunkPolicy>::sort(chunk, chunk + count, comparator,
+						ChunkPolicy(chunkSize * sizeof(Record)));
+
+			// Records not less than the last one of the open run continue it
+			size_t continued = 0;
+			if (openRun != nullptr) {
+				continued = count - (std::partition_point(chunk, chunk + count, [&](const Record& r) {
+					return comparator(r, openRunLast);
+				}) - chunk);
+			}
+			size_t started = count - continued;
+
+			FILE* continuedRun = openRun;
+			FILE* startedRun = nullptr;
+			if (started > 0) {
+				runs.push_back(nextRunPath());
+				startedRun = std::fopen(runs.back().c_str(), "wb");
+				if (startedRun == nullptr) {
+					success = false;
+					break;
+				}
+				openRun = startedRun;
+				openRunLast = chunk[started - 1];
+			} else {
+				openRunLast = chunk[count - 1];
+			}
+
+			lastWrite = std::async(std::launch::async, [=]() {
+				bool written = true;
+				if (continued > 0)
+					written = std::fwrite(chunk + started, sizeof(Record), continued, continuedRun) == continued;
+				if (startedRun != nullptr) {
+					if (continuedRun != nullptr && std::fclose(continuedRun) != 0)
+						written = false;
+					if (std::fwrite(chunk, sizeof(Record), started, startedRun) != started)
+						written = false;
+				}
+				return written;
+			});
+		}
+
+		if (nextRead.valid())
+			nextRead.wait();
+		if (lastWrite.valid() && !lastWrite.get())
+			success = false;
+		if (openRun != nullptr && std::fclose(openRun) != 0)
+			success = false;
+		std::fclose(input);
+		return success;
+	}
+
+	static std::future<size_t> readChunk(FILE* input, std::vector<Record>& chunk) {
+		Record* target = chunk.data();
+		size_t size = chunk.size();
+		return std::async(std::launch::async, [=]() {
+			size_t bytes = std::fread(target, 1, size * sizeof(Record), input);
+			if (std::ferror(input) || bytes % sizeof(Record) != 0)
+				return static_cast<size_t>(-1);
+			return bytes / sizeof(Record);
+		});
+	}
+
+	// Every reader and the writer get two blocks
+	size_t blockSize(unsigned int ways) const {
+		return std::max<size_t>(1, memoryBudget / (2 * (ways + 1) * sizeof(Record)));
+	}
+
+	unsigned int mergeWays() const {
+		size_t ways = memoryBudget / (2 * MIN_BLOCK_SIZE);
+		if (ways > 0)
+			--ways;
+		return static_cast<unsigned int>(std::max<size_t>(2, std::min<size_t>(ways, MAX_MERGE_WAYS)));
+	}
+
+	// Equal records are taken from the earlier run first
+	bool mergeRunFiles(const std::vector<std::string>& inputs, const std::string& output) const {
+		unsigned int ways = static_cast<unsigned int>(inputs.size());
+		size_t size = blockSize(ways);
+
+		std::vector<std::unique_ptr<RecordReader<Record>>> readers;
+		for (unsigned int i = 0; i < ways; ++i)
+			readers.emplace_back(new RecordReader<Record>(std::fopen(inputs[i].c_str(), "rb"), size));
+		RecordWriter<Record> writer(std::fopen(output.c_str(), "wb"), size);
+		if (!writer.good())
+			return false;
+
+		auto later = [&](unsigned int a, unsigned int b) {
+			const Record& x = readers[a]->front();
+			const Record& y = readers[b]->front();
+			return comparator(y, x) || (!comparator(x, y) && b < a);
+		};
+
+		std::vector<unsigned int> heap;
+		for (unsigned int i = 0; i < ways; ++i) {
+			if (!readers[i]->good())
+				return false;
+			if (!readers[i]->empty())
+				heap.push_back(i);
+		}
+		std::make_heap(heap.begin(), heap.end(), later);
+
+		while (!heap.empty()) {
+			std::pop_heap(heap.begin(), heap.end(), later);
+			RecordReader<Record>& reader = *readers[heap.back()];
+			writer.push(reader.front());
+			reader.pop();
+			if (reader.empty())
+				heap.pop_back();
+			else
+				std::push_heap(heap.begin(), heap.end(), later);
+		}
+
+		bool success = writer.close();
+		for (unsigned int i = 0; i < ways; ++i)
+			success = success && readers[i]->good();
+		return success;
+	}
+
+	bool mergeRuns() {
+		unsigned int ways = mergeWays();
+		while (runs.size() > ways) {
+			std::vector<std::string> merged;
+			for (size_t i = 0; i < runs.size(); i += ways) {
+				std::vector<std::string> group(runs.begin() + i, runs.begin() + std::min(i + ways, runs.size()));
+				if (group.size() == 1) {
+					merged.push_back(group[0]);
+					continue;
+				}
+
+				merged.push_back(nextRunPath());
+				if (!mergeRunFiles(group, merged.back()))
+					return false;
+				removeFiles(group);
+			}
+			runs.swap(merged);
+		}
+
+		if (runs.size() == 1 && std::rename(runs[0].c_str(), outputPath.c_str()) == 0) {
+			runs.clear();
+			return true;
+		}
+
+		if (!mergeRunFiles(runs, outputPath))
+			return false;
+		removeFiles(runs);
+		runs.clear();
+		return true;
+	}
+
+	static void removeFiles(const std::vector<std::string>& paths) {
+		for (size_t i = 0; i < paths.size(); ++i)
+			std::remove(paths[i].c_str());
+	}
+
+public:
+	// Returns false if a file can't be read or written, or the input is not made of whole records
+	static bool sort(const std::string& inputPath, const std::string& outputPath,
+			const Comparator& comparator, size_t memoryBudget) {
+
+		ExternalSortController controller(inputPath, outputPath, comparator, memoryBudget);
+		bool success = controller.makeRuns() && controller.mergeRuns();
+		removeFiles(controller.runs);
+		return success;
+	}
+};
@@ -1,21 +1,31 @@
-#include <stack>
-#include <cmath>
 #include <iterator>
 #include <typeinfo>
+#include <algorithm>
+#include <functional>
+#include <new>
+#include <utility>
+#include <vector>
+#include <memory>
+#include <cmath>
+
+#include "timsort-parallel.h"
+#include "timsort-simd.h"
+#include "timsort-radix.h"
+#include "timsort-profile.h"
 
 
 
-class DefaultTimSortParams: public ITimSortParams {
+class DefaultTimSortPolicy: public TimSortPolicyBase {
 public:
-	unsigned int minRun(unsigned int n) const {
+	static unsigned int minRun(unsigned int n) {
 		return 48;
 	}
 
-	bool needMerge(unsigned int lenX, unsigned int lenY) const {
+	static bool needMerge(unsigned int lenX, unsigned int lenY) {
 		return lenX >= lenY;
 	}
 
-	EWhatMerge whatMerge(unsigned int lenX, unsigned int lenY, unsigned int lenZ) const {
+	static EWhatMerge whatMerge(unsigned int lenX, unsigned int lenY, unsigned int lenZ) {
 		if (lenX < lenY && lenX + lenY < lenZ)
 			return WM_NoMerge;
 
@@ -25,35 +35,351 @@ public:
 		return WM_MergeYZ;
 	}
 
-	unsigned int GetGallop() const {
+	static unsigned int GetGallop() {
 		return 7;
 	}
+
+	static bool IsGallopAdaptive() {
+		return true;
+	}
+};
+
+
+// Powersort (Munro, Wild): the power of a boundary is the depth of the node splitting
+// the midpoints of both runs in the perfectly balanced merge tree over [0, n)
+class PowerSortPolicy: public DefaultTimSortPolicy {
+public:
+	static EMergeStrategy GetMergeStrategy() {
+		return MS_NodePower;
+	}
+
+	static unsigned int nodePower(size_t beginX, size_t beginY, size_t endY, size_t n) {
+		// a and b are the doubled midpoints of X and Y, compared bit by bit in units of n
+		size_t a = beginX + beginY;
+		size_t b = beginY + endY;
+		unsigned int power = 0;
+		while (true) {
+			++power;
+			if (a >= n) {
+				a -= n;
+				b -= n;
+			} else if (b >= n) {
+				break;
+			}
+			a <<= 1;
+			b <<= 1;
+		}
+		return power;
+	}
 };
 
 
+// Exposes a compile-time policy through the virtual ITimSortParams interface
+template <class Policy>
+class TimSortParamsAdapter: public ITimSortParams {
+private:
+	const Policy policy;
+
+public:
+	TimSortParamsAdapter(const Policy& policy = Policy())
+		:policy(policy)
+	{}
+
+	unsigned int minRun(unsigned int n) const {
+		return policy.minRun(n);
+	}
+
+	bool needMerge(unsigned int lenX, unsigned int lenY) const {
+		return policy.needMerge(lenX, lenY);
+	}
+
+	EWhatMerge whatMerge(unsigned int lenX, unsigned int lenY, unsigned int lenZ) const {
+		return policy.whatMerge(lenX, lenY, lenZ);
+	}
+
+	unsigned int GetGallop() const {
+		return policy.GetGallop();
+	}
+
+	bool IsGallopAdaptive() const {
+		return policy.IsGallopAdaptive();
+	}
+
+	size_t GetBufferBudget() const {
+		return policy.GetBufferBudget();
+	}
+
+	EMergeStrategy GetMergeStrategy() const {
+		return policy.GetMergeStrategy();
+	}
+
+	unsigned int nodePower(size_t beginX, size_t beginY, size_t endY, size_t n) const {
+		return policy.nodePower(beginX, beginY, endY, n);
+	}
+
+	unsigned int GetThreadsCount() const {
+		return policy.GetThreadsCount();
+	}
+};
+
+class DefaultTimSortParams: public TimSortParamsAdapter<DefaultTimSortPolicy> {
+};
+
+class PowerSortParams: public TimSortParamsAdapter<PowerSortPolicy> {
+};
+
+
+template <class T>
+class MergeBuffer {
+private:
+	T* data;
+	size_t capacity;
+
+	MergeBuffer(const MergeBuffer&);
+	MergeBuffer& operator =(const MergeBuffer&);
+
+public:
+	MergeBuffer()
+		:data(nullptr), capacity(0)
+	{}
+
+	// Storage is raw: elements are constructed and destroyed by the merge that uses them
+	bool reserve(size_t count, size_t budget) {
+		if (count <= capacity)
+			return true;
+
+		size_t maxCount = budget / sizeof(T);
+		if (count > maxCount)
+			return false;
+
+		size_t newCapacity = std::min(std::max(count, capacity * 2), maxCount);
+		T* newData = static_cast<T*>(::operator new(newCapacity * sizeof(T), std::nothrow));
+		if (newData == nullptr)
+			return false;
+
+		::operator delete(data);
+		data = newData;
+		capacity = newCapacity;
+		return true;
+	}
+
+	T* get() const {
+		return data;
+	}
+
+	~MergeBuffer() {
+		::operator delete(data);
+	}
+};
+
+
+// Length of the longest prefix of [b, e) satisfying pred (pred must hold on a prefix only),
+// found by galloping: probes at 1, 2, 4... elements, then a binary search
+template <class Iterator, class Predicate>
+size_t timSortGallopCount(Iterator b, Iterator e, Predicate pred) {
+	size_t size = static_cast<size_t>(e - b);
+	size_t l = 0, r = 1;
+	while (r < size && pred(b[r - 1])) {
+		l = r;
+		r <<= 1;
+	}
+	if (r > size)
+		r = size;
+
+	while (l < r) {
+		size_t m = (l + r) >> 1;
+		if (pred(b[m])) {
+			l = m + 1;
+		} else {
+			r = m;
+		}
+	}
+
+	return l;
+}
+
+
 template <class SortIterator,
-	class Comparator = std::less<typename std::iterator_traits<SortIterator>::value_type>>
+	class Comparator = std::less<typename std::iterator_traits<SortIterator>::value_type>,
+	class Params = ITimSortParams>
 class TimSortController {
 private:
 	typedef typename std::iterator_traits<SortIterator>::value_type Value;
 	typedef typename std::iterator_traits<SortIterator>::difference_type Distance;
 
-	class RunController;
+	class RunController {
+	private:
+		SortIterator _begin, _end;
+		int _node;
+
+	public:
+		RunController()
+			:_node(-1)
+		{}
+
+		RunController(SortIterator begin, SortIterator end)
+			:_begin(begin), _end(end), _node(-1)
+		{}
+
+		// Index of the recorded merge that produced the run, -1 for a run made by makeRun
+		int node() const {
+			return _node;
+		}
+		void setNode(int node) {
+			_node = node;
+		}
+
+		void join(const RunController& run) {
+			_end = run._end;
+		}
+
+		unsigned int size() const {
+			return static_cast<unsigned int>(_end - _begin);
+		}
+
+		const SortIterator begin() const {
+			return _begin;
+		}
+		const SortIterator end() const {
+			return _end;
+		}
+
+//		void coutRun() const {
+//			std::cout << "Run[" << _begin - parentController.begin <<
+//						", " << _end - parentController.begin << ")=" << size() << ";\n";
+//		}
+//		void coutRunContent() const {
+//			coutRun();
+//			for (SortIterator it = _begin; it < _end; ++it) {
+//				std::cout << ' ' << *it;
+//			}
+//			std::cout << '\n';
+//		}
+
+	private:
+		// [_begin, sortedEnd) is already sorted, the rest is inserted with a binary search
+		void sortRun(SortIterator sortedEnd, const Comparator& comparator) const {
+			for (SortIterator it = sortedEnd; it < _end; ++it) {
+				SortIterator t = std::upper_bound(_begin, it, *it, comparator);
+				if (t == it)
+					continue;
+
+				Value v = std::move(*it);
+				std::move_backward(t, it, it + 1);
+				*t = std::move(v);
+			}
+		}
+		void reverseRun() const {
+			SortIterator a = _begin;
+			SortIterator b = _end;
+
+			while (a < b) {
+				swapIterators(a++, --b);
+			}
+		}
+
+	public:
+		static RunController makeRun(SortIterator start, SortIterator minPos, SortIterator finish,
+					const TimSortController& tsController) {
+			SortIterator begin = start;
+			SortIterator end = start + 1;
+			bool compareType = false;
+			bool resortFlag = false;
+
+			if (end != finish) {
+
+				compareType = tsController.comparator(*end, *start);
+				++end;
+
+				while (end < finish && tsController.comparator(end[0], end[-1]) == compareType) {
+					++end;
+				}
+			}
+
+			SortIterator naturalEnd = end;
+			if (compareType)
+				RunController(begin, naturalEnd).reverseRun();
+
+			while (end < minPos && end < finish) {
+				++end;
+				resortFlag = true;
+			}
+
+			RunController controller(begin, end);
+			if (resortFlag && (naturalEnd - begin > (end - begin) / 2 ||
+						!SortingNetwork<Value, SortingNetworkOrder<Value, Comparator>::value>::sort(begin, end)))
+				controller.sortRun(naturalEnd, tsController.comparator);
+
+			return controller;
+		}
+	};
+
 
 	const SortIterator begin, end;
-	const Comparator& comparator;
-	const ITimSortParams& params;
-	std::stack<RunController> runStack;
+	const Comparator comparator;
+	const Params& params;
+	MergeBuffer<Value> buffer;
+	const bool adaptiveGallop;
+	unsigned int minGallop;
+
+	// Run lengths on a balanced stack grow at least as Fibonacci numbers, so log_phi(2^64) < 96
+	static const unsigned int MAX_RUNS_COUNT = 96;
+	RunController runStack[MAX_RUNS_COUNT];
+	unsigned int runPowers[MAX_RUNS_COUNT];
+	unsigned int runsCount;
+	const unsigned int runsCapacity;
+
+	struct MergeNode {
+		SortIterator b, m, e;
+		int left, right;
+		unsigned int depth;
+	};
+
+	// Smaller inputs are sorted on the calling thread only, smaller merges are sequential;
+	// deeper merge trees (from unbalanced params) are merged in recorded order
+	static const size_t PARALLEL_MIN_SIZE = 1 << 16;
+	static const size_t PARALLEL_MERGE_MIN_SIZE = 1 << 17;
+	static const unsigned int MAX_FORK_DEPTH = 256;
+
+	// Keys of integers and floats under std::less or std::greater may be radix sorted; the
+	// choice is made once the first runs cover a part of the input
+	typedef RadixSort<Value, SortingNetworkOrder<Value, Comparator>::value> Radix;
+	static const size_t RADIX_MIN_SIZE = 1 << 14;
+	static const size_t RADIX_SAMPLE_PART = 16;
+	TimSortThreadPool* pool;
+	const unsigned int workerId;
+	std::vector<MergeNode>* mergeTree;
+
+	// Partial sort: runs keep their first topCount elements only, 0 for a full sort
+	size_t topCount;
 
 	TimSortController(const SortIterator& begin, const SortIterator& end,
-			const Comparator& comparator, const ITimSortParams& params)
-		:begin(begin), end(end), comparator(comparator), params(params) {}
+			const Comparator& comparator, const Params& params,
+			TimSortThreadPool* pool = nullptr, unsigned int workerId = 0)
+		:begin(begin), end(end), comparator(comparator), params(params),
+		 adaptiveGallop(params.IsGallopAdaptive()), minGallop(params.GetGallop()),
+		 runsCount(0), runsCapacity(runStackCapacity(end - begin)),
+		 pool(pool), workerId(workerId), mergeTree(nullptr), topCount(0) {}
+
+	static unsigned int runStackCapacity(size_t n) {
+		unsigned int capacity = 2;
+		for (size_t a = 1, b = 1; b <= n && capacity < MAX_RUNS_COUNT; ++capacity) {
+			size_t c = a + b;
+			a = b;
+			b = c;
+		}
+		return capacity;
+	}
 
 
 	void sort() {
+		TIMSORT_PHASE(TP_RunFormation);
 		unsigned int minRunSize = params.minRun(static_cast<unsigned int>(end - begin));
 
 		SortIterator lastIndexIterator = begin;
+		size_t radixSampleSize = Radix::supported && static_cast<size_t>(end - begin) >= RADIX_MIN_SIZE ?
+					static_cast<size_t>(end - begin) / RADIX_SAMPLE_PART : 0;
+		size_t runsMade = 0;
 
 		while (lastIndexIterator < end) {
 			unsigned int curMinSize =
@@ -61,21 +387,238 @@ private:
 			RunController nextRun =
 					RunController::makeRun(lastIndexIterator, lastIndexIterator+curMinSize, end, *this);
 			lastIndexIterator = nextRun.end();
-			pushRun(nextRun);
-			checkStack();
+			addRun(nextRun);
+			++runsMade;
+
+			if (radixSampleSize > 0 && static_cast<size_t>(lastIndexIterator - begin) >= radixSampleSize) {
+				if (static_cast<size_t>(lastIndexIterator - begin) < 2 * runsMade * minRunSize && radixSort())
+					return;
+				radixSampleSize = 0;
+			}
 		}
 
-		while (runStack.size() > 1) {
-			RunController x = popRun();
-			RunController y = popRun();
-			mergeRuns(y, x);
-			pushRun(y);
-			checkStack();
+		collapseRuns();
+	}
+
+	// The runs of the sample barely grew past minRun, so the input has too little order for
+	// the merges to pay off. The whole range is radix sorted, the runs made so far included.
+	bool radixSort() {
+		TIMSORT_PHASE(TP_Radix);
+		size_t count = static_cast<size_t>(end - begin);
+		if (!buffer.reserve(count, params.GetBufferBudget()) || !Radix::sort(begin, end, buffer.get()))
+			return false;
+
+		runsCount = 0;
+		return true;
+	}
+
+	// Runs keep at most topCount elements. Once a run has topCount elements, its last one bounds
+	// the top: only elements less than it are gathered, next to the runs on the stack, and
+	// sorted into new runs. The dropped elements are left behind the stack.
+	void partialSort(size_t count) {
+		TIMSORT_PHASE(TP_RunFormation);
+		unsigned int minRunSize = params.minRun(static_cast<unsigned int>(end - begin));
+		topCount = count;
+
+		SortIterator lastIndexIterator = begin;
+		while (lastIndexIterator < end) {
+			SortIterator stackEnd = runsCount > 0 ? runStack[runsCount - 1].end() : begin;
+			SortIterator runEnd = end;
+			SortIterator runBegin = lastIndexIterator;
+
+			const Value* bound = topBound();
+			if (bound != nullptr) {
+				SortIterator gathered = stackEnd;
+				while (lastIndexIterator < end && gathered - stackEnd < minRunSize) {
+					if (comparator(*lastIndexIterator, *bound)) {
+						if (gathered != lastIndexIterator)
+							swapIterators(gathered, lastIndexIterator);
+						++gathered;
+					}
+					++lastIndexIterator;
+				}
+				if (gathered == stackEnd)
+					continue;
+
+				runBegin = stackEnd;
+				runEnd = gathered;
+			}
+
+			unsigned int curMinSize = std::min(minRunSize, static_cast<unsigned int>(runEnd - runBegin));
+			RunController nextRun = RunController::makeRun(runBegin, runBegin + curMinSize, runEnd, *this);
+			if (bound == nullptr)
+				lastIndexIterator = nextRun.end();
+
+			size_t kept = std::min(static_cast<size_t>(nextRun.size()), topCount);
+			moveDown(stackEnd, nextRun.begin(), kept);
+			addRun(RunController(stackEnd, stackEnd + kept));
+		}
+
+		collapseRuns();
+	}
+
+	// The least last element of the runs that have topCount elements
+	const Value* topBound() const {
+		const Value* bound = nullptr;
+		for (unsigned int i = 0; i < runsCount; ++i) {
+			if (runStack[i].size() != topCount)
+				continue;
+
+			const Value& last = runStack[i].end()[-1];
+			if (bound == nullptr || comparator(last, *bound))
+				bound = &last;
+		}
+		return bound;
+	}
+
+	// Moves [from, from + count) to to; the dropped elements in [to, from) may be reordered
+	static void moveDown(SortIterator to, SortIterator from, size_t count) {
+		if (to == from)
+			return;
+
+		if (static_cast<size_t>(from - to) >= count)
+			std::swap_ranges(from, from + count, to);
+		else
+			std::rotate(to, from, from + count);
+	}
+
+	// Runs are formed in parallel, then the params decide the merge order as usual, but merges
+	// are only recorded. Independent subtrees of the recorded tree are merged by different
+	// threads, every thread with its own controller (buffer and gallop state).
+	void sortInParallel() {
+		unsigned int minRunSize = params.minRun(static_cast<unsigned int>(end - begin));
+
+		std::vector<RunController> runs = makeRunsInParallel(minRunSize);
+		std::vector<MergeNode> tree;
+		mergeTree = &tree;
+		for (unsigned int i = 0; i < runs.size(); ++i)
+			addRun(runs[i]);
+		collapseRuns();
+		mergeTree = nullptr;
+
+		if (tree.empty())
+			return;
+
+		if (tree.back().depth > MAX_FORK_DEPTH) {
+			for (unsigned int i = 0; i < tree.size(); ++i)
+				mergeNode(tree[i]);
+			return;
+		}
+
+		std::vector<std::unique_ptr<TimSortController>> workers;
+		for (unsigned int i = 0; i < pool->threadsCount(); ++i)
+			workers.emplace_back(new TimSortController(begin, end, comparator, params, pool, i));
+		mergeSubtree(tree, static_cast<int>(tree.size()) - 1, workerId, workers);
+	}
+
+	static void mergeSubtree(const std::vector<MergeNode>& tree, int index, unsigned int worker,
+				std::vector<std::unique_ptr<TimSortController>>& workers) {
+		const MergeNode& node = tree[index];
+		TimSortThreadPool* pool = workers[worker]->pool;
+
+		if (node.left >= 0 && node.right >= 0) {
+			std::atomic<unsigned int> pending(0);
+			pool->spawn(worker, [&](unsigned int thief) {
+				mergeSubtree(tree, node.left, thief, workers);
+			}, pending);
+			mergeSubtree(tree, node.right, worker, workers);
+			pool->wait(worker, pending);
+		} else if (node.left >= 0) {
+			mergeSubtree(tree, node.left, worker, workers);
+		} else if (node.right >= 0) {
+			mergeSubtree(tree, node.right, worker, workers);
+		}
+
+		workers[worker]->mergeNode(node);
+	}
+
+	void mergeNode(const MergeNode& node) {
+		RunController x(node.b, node.m), y(node.m, node.e);
+		mergeRuns(x, y);
+	}
+
+	// Every thread forms runs in its own segment; a run that is continued in order by the
+	// first run of the next segment is joined with it
+	std::vector<RunController> makeRunsInParallel(unsigned int minRunSize) {
+		unsigned int segmentsCount = pool->threadsCount();
+		size_t segmentSize = (static_cast<size_t>(end - begin) + segmentsCount - 1) / segmentsCount;
+		std::vector<std::vector<RunController>> segmentRuns(segmentsCount);
+
+		pool->parallelFor(workerId, segmentsCount, [&](unsigned int segment) {
+			TIMSORT_PHASE(TP_RunFormation);
+			SortIterator segmentBegin = begin + std::min(segmentSize * segment, static_cast<size_t>(end - begin));
+			SortIterator segmentEnd = begin + std::min(segmentSize * (segment + 1), static_cast<size_t>(end - begin));
+
+			SortIterator lastIndexIterator = segmentBegin;
+			while (lastIndexIterator < segmentEnd) {
+				unsigned int curMinSize =
+						std::min(minRunSize, static_cast<unsigned int>(segmentEnd - lastIndexIterator));
+				RunController nextRun = RunController::makeRun(lastIndexIterator,
+							lastIndexIterator + curMinSize, segmentEnd, *this);
+				lastIndexIterator = nextRun.end();
+				segmentRuns[segment].push_back(nextRun);
+			}
+		});
+
+		std::vector<RunController> runs;
+		for (unsigned int segment = 0; segment < segmentsCount; ++segment) {
+			for (unsigned int i = 0; i < segmentRuns[segment].size(); ++i) {
+				const RunController& run = segmentRuns[segment][i];
+				if (i == 0 && !runs.empty() && !comparator(*run.begin(), run.begin()[-1]))
+					runs.back().join(run);
+				else
+					runs.push_back(run);
+			}
+		}
+		return runs;
+	}
+
+	void addRun(const RunController& run) {
+		if (params.GetMergeStrategy() == MS_NodePower) {
+			pushRunByPower(run);
+			return;
 		}
+
+		// Params that do not keep the stack balanced get their top runs merged
+		if (runsCount == runsCapacity)
+			mergeTopRuns();
+
+		pushRun(run);
+		checkStack();
+	}
+
+	void collapseRuns() {
+		while (runsCount > 1) {
+			mergeTopRuns();
+			if (params.GetMergeStrategy() == MS_RunLengths)
+				checkStack();
+		}
+	}
+
+	// Powersort powers grow to the top of the stack and stay below log2(n) + 2, the capacity
+	// check only guards against a custom nodePower
+	void pushRunByPower(const RunController& run) {
+		if (runsCount > 0) {
+			const RunController& top = runStack[runsCount - 1];
+			unsigned int power = params.nodePower(top.begin() - begin, run.begin() - begin,
+						run.end() - begin, end - begin);
+
+			while (runsCount > 1 && (runPowers[runsCount - 2] > power || runsCount == runsCapacity))
+				mergeTopRuns();
+			runPowers[runsCount - 1] = power;
+		}
+		pushRun(run);
+	}
+
+	void mergeTopRuns() {
+		RunController x = popRun();
+		RunController y = popRun();
+		mergeRuns(y, x);
+		pushRun(y);
 	}
 
 	void checkStack() {
-		if (runStack.size() == 2) {
+		if (runsCount == 2) {
 			RunController x = popRun();
 			RunController y = popRun();
 
@@ -87,7 +630,7 @@ private:
 				pushRun(y);
 				pushRun(x);
 			}
-		} else if (runStack.size() > 2) {
+		} else if (runsCount > 2) {
 			RunController x = popRun();
 			RunController y = popRun();
 			RunController z = popRun();
@@ -125,311 +668,578 @@ private:
 //		std::cout << '\n';
 	}
 
-	void mergeRuns(RunController& x, RunController& y) const {
-		inplaceMerge(x.begin(), y.begin(), y.end());
-		x.join(y);
-	}
-
-	void inplaceMerge(SortIterator b, SortIterator m, SortIterator e) const {
+	void mergeRuns(RunController& x, RunController& y) {
+		SortIterator b = x.begin(), m = y.begin(), e = y.end();
 
-		unsigned int fullSize = static_cast<unsigned int>(e - b);
-		unsigned int blockSize = static_cast<unsigned int>(std::sqrt(fullSize));
-		unsigned int blocksCount = (fullSize + blockSize - 1) / blockSize;
-		unsigned int yellowId = -1;
+		if (mergeTree != nullptr) {
+			unsigned int depth = 1;
+			if (x.node() >= 0)
+				depth = std::max(depth, (*mergeTree)[x.node()].depth + 1);
+			if (y.node() >= 0)
+				depth = std::max(depth, (*mergeTree)[y.node()].depth + 1);
 
-		if (blocksCount < 5) {
-			// Insert sort
-			RunController::makeRun(b, e, e, *this);
+			MergeNode node = {b, m, e, x.node(), y.node(), depth};
+			mergeTree->push_back(node);
+			x.join(y);
+			x.setNode(static_cast<int>(mergeTree->size()) - 1);
 			return;
 		}
 
-		RunController** blocks = inplaceMergeMakeDecomposition(b, m, e, blocksCount, blockSize, yellowId);
-		inplaceMergeSortOfBlocks(blocks, yellowId);
-		inplaceMergeMergeNeighbours(blocks, yellowId);
-
-		unsigned int s = blocks[blocksCount - 1]->size() + blocks[yellowId]->size();
-		RunController::makeRun(e - s * 2, e, e, *this);
+		TIMSORT_PHASE(TP_Merge);
+		if (topCount > 0) {
+			if (x.end() != m) {
+				moveDown(x.end(), m, e - m);
+				e = x.end() + (e - m);
+				m = x.end();
+			}
+			x = RunController(b, b + std::min(static_cast<size_t>(e - b), topCount));
+		} else {
+			x.join(y);
+		}
 
-		SortIterator buf = inplaceMergeFinalIterativeMerge(b, m, e, s);
+		// Elements of X not greater than Y[0] and elements of Y not less than X[last]
+		// are already in place
+		const Value& firstY = *m;
+		b += timSortGallopCount(b, m, [&](const Value& v) {
+			return !comparator(firstY, v);
+		});
+		if (b == m)
+			return;
 
-		RunController::makeRun(buf, e, e, *this);
+		typedef std::reverse_iterator<SortIterator> ReverseIterator;
+		const Value& lastX = m[-1];
+		e -= timSortGallopCount(ReverseIterator(e), ReverseIterator(m), [&](const Value& v) {
+			return !comparator(v, lastX);
+		});
+
+		size_t lenX = m - b, lenY = e - m;
+		if (pool != nullptr && lenX + lenY >= PARALLEL_MERGE_MIN_SIZE &&
+				buffer.reserve(lenX + lenY, params.GetBufferBudget())) {
+			parallelMerge(b, m, e);
+		} else if (buffer.reserve(std::min(lenX, lenY), params.GetBufferBudget())) {
+			if (lenX <= lenY)
+				bufferedMergeLo(b, m, e);
+			else
+				bufferedMergeHi(b, m, e);
+		} else {
+			TIMSORT_PHASE(TP_InplaceMerge);
+			inplaceMerge(b, m, e);
+		}
+	}
 
-		for (unsigned int i = 0; i < blocksCount; ++i)
-			delete blocks[i];
-		delete[] blocks;
+	// Both runs go to the buffer; the output is cut into equal parts and the merge path
+	// (co-rank) of every cut tells which parts of X and Y it takes, so parts merge independently
+	void parallelMerge(SortIterator b, SortIterator m, SortIterator e) {
+		size_t lenX = m - b, lenY = e - m;
+		unsigned int partsCount = pool->threadsCount();
+		Value* const bufX = buffer.get();
+		Value* const bufY = bufX + lenX;
+
+		pool->parallelFor(workerId, partsCount, [&](unsigned int part) {
+			TIMSORT_PHASE(TP_Merge);
+			size_t from = (lenX + lenY) * part / partsCount;
+			size_t to = (lenX + lenY) * (part + 1) / partsCount;
+			for (size_t i = from; i < to; ++i)
+				new (bufX + i) Value(std::move(b[i]));
+		});
+
+		pool->parallelFor(workerId, partsCount, [&](unsigned int part) {
+			TIMSORT_PHASE(TP_Merge);
+			size_t from = (lenX + lenY) * part / partsCount;
+			size_t to = (lenX + lenY) * (part + 1) / partsCount;
+			size_t fromX = mergePathRank(bufX, lenX, bufY, lenY, from);
+			size_t toX = mergePathRank(bufX, lenX, bufY, lenY, to);
+
+			Value* itX = bufX + fromX;
+			Value* const endX = bufX + toX;
+			Value* itY = bufY + (from - fromX);
+			Value* const endY = bufY + (to - toX);
+			SortIterator itRes = b + from;
+
+			MergeKernel<Value>::merge(itX, endX, itY, endY, itRes, comparator);
+			itRes = std::move(itX, endX, itRes);
+			std::move(itY, endY, itRes);
+		});
+
+		destroyBuffer(bufX, bufX + lenX + lenY);
 	}
 
-	RunController** inplaceMergeMakeDecomposition(SortIterator b, SortIterator m, SortIterator e,
-			unsigned int blocksCount, unsigned int blockSize, unsigned int& yellowId) {
-		RunController** blocks = new RunController*[blocksCount];
-		for (unsigned int i = 0; i < blocksCount; ++i) {
-			blocks[i] = RunController::getUnsortedRunPointer(
-						b + blockSize * i, std::min(e, b + blockSize * (i + 1)), *this);
-			if (blocks[i]->begin() <= m && blocks[i]->end() > m) {
-				yellowId = i;
-			}
+	// Count of X elements among the first d elements of the stable merge of X and Y
+	size_t mergePathRank(const Value* x, size_t lenX, const Value* y, size_t lenY, size_t d) const {
+		size_t l = d > lenY ? d - lenY : 0;
+		size_t r = std::min(d, lenX);
+		while (l < r) {
+			size_t i = (l + r) >> 1;
+			if (comparator(y[d - i - 1], x[i]))
+				r = i;
+			else
+				l = i + 1;
 		}
-		RunController::swapRuns(*(blocks[yellowId]), *(blocks[blocksCount - 2]));
-		yellowId = blocksCount - 2;
-		return blocks;
+		return l;
 	}
 
-	void inplaceMergeSortOfBlocks(RunController** blocks, unsigned int yellowId) {
-		for (unsigned int i = 0; i < yellowId; ++i) {
-			unsigned int minRun = i;
-			SortIterator minIt = blocks[minRun]->begin();
+	// [b, m) goes to the buffer, the merge runs forward from b
+	void bufferedMergeLo(SortIterator b, SortIterator m, SortIterator e) {
+		Value* const bufBegin = buffer.get();
+		Value* bufEnd = bufBegin;
+		for (SortIterator it = b; it < m; ++it, ++bufEnd)
+			new (bufEnd) Value(std::move(*it));
 
-			for (unsigned int j = i + 1; j < yellowId; ++j) {
-				SortIterator it = blocks[j]->begin();
-				if (comparator(*it, *minIt)) {
-					minIt = it;
-					minRun = j;
-				}
-			}
+		Value* itBuf = bufBegin;
+		SortIterator itMain = m;
+		SortIterator itRes = b;
 
-			if (minRun != i)
-				RunController::swapRuns(*blocks[i], *blocks[minRun]);
-		}
-	}
+		unsigned int gallop = params.GetGallop();
+		while (true) {
+			MergeKernel<Value>::mergeLo(itBuf, bufEnd, itMain, e, itRes, comparator, minGallop);
+			if (itBuf == bufEnd || itMain == e)
+				break;
 
-	void inplaceMergeMergeNeighbours(RunController** blocks, unsigned int yellowId) {
-		for (unsigned int i = 0; i + 1 < yellowId; ++i) {
-			RunController* x = blocks[i];
-			RunController* y = blocks[i + 1];
-			simpleMerge(x->begin(), x->end(), y->begin(), y->end(), blocks[yellowId]->begin());
+			// One side keeps winning: move whole streaks while they stay long. Entering and
+			// leaving cost a step of minGallop each, every round of galloping earns one back
+			if (adaptiveGallop)
+				++minGallop;
+			TIMSORT_PHASE(TP_Gallop);
+			bool galloping = true;
+			while (galloping && itBuf < bufEnd && itMain < e) {
+				if (adaptiveGallop && minGallop > 1)
+					--minGallop;
+
+				const Value& pivotMain = *itMain;
+				size_t bufCount = timSortGallopCount(itBuf, bufEnd, [&](const Value& v) {
+					return !comparator(pivotMain, v);
+				});
+				itRes = std::move(itBuf, itBuf + bufCount, itRes);
+				itBuf += bufCount;
+				if (itBuf == bufEnd)
+					break;
+
+				const Value& pivotBuf = *itBuf;
+				size_t mainCount = timSortGallopCount(itMain, e, [&](const Value& v) {
+					return comparator(v, pivotBuf);
+				});
+				itRes = std::move(itMain, itMain + mainCount, itRes);
+				itMain += mainCount;
+
+				galloping = bufCount >= gallop || mainCount >= gallop;
+			}
+			if (adaptiveGallop)
+				++minGallop;
 		}
+		std::move(itBuf, bufEnd, itRes);
+
+		destroyBuffer(bufBegin, bufEnd);
 	}
 
-	SortIterator inplaceMergeFinalIterativeMerge(SortIterator b, SortIterator e, unsigned int s) {
-		SortIterator buf = e - s;
-		SortIterator gammaIterator = buf;
-		SortIterator betaIterator = gammaIterator - s;
-		SortIterator alphaIterator = betaIterator - s;
-		while (betaIterator > b) {
-			if (alphaIterator < b)
-				alphaIterator = b;
+	// [m, e) goes to the buffer, the merge runs backward from e; galloping mirrors bufferedMergeLo
+	void bufferedMergeHi(SortIterator b, SortIterator m, SortIterator e) {
+		Value* const bufBegin = buffer.get();
+		Value* bufEnd = bufBegin;
+		for (SortIterator it = m; it < e; ++it, ++bufEnd)
+			new (bufEnd) Value(std::move(*it));
 
-			simpleMerge(alphaIterator, betaIterator, betaIterator, gammaIterator, buf);
+		Value* itBuf = bufEnd;
+		SortIterator itMain = m;
+		SortIterator itRes = e;
+
+		typedef std::reverse_iterator<SortIterator> ReverseIterator;
+		typedef std::reverse_iterator<Value*> ReverseBufferIterator;
+		unsigned int gallop = params.GetGallop();
+		while (true) {
+			MergeKernel<Value>::mergeHi(bufBegin, itBuf, b, itMain, itRes, comparator, minGallop);
+			if (itBuf == bufBegin || itMain == b)
+				break;
 
-			gammaIterator = betaIterator;
-			betaIterator = alphaIterator;
-			alphaIterator -= s;
+			if (adaptiveGallop)
+				++minGallop;
+			TIMSORT_PHASE(TP_Gallop);
+			bool galloping = true;
+			while (galloping && itBuf > bufBegin && itMain > b) {
+				if (adaptiveGallop && minGallop > 1)
+					--minGallop;
+
+				// Equal elements of the left run stay before the right one
+				const Value& pivotBuf = itBuf[-1];
+				size_t mainCount = timSortGallopCount(ReverseIterator(itMain), ReverseIterator(b), [&](const Value& v) {
+					return comparator(pivotBuf, v);
+				});
+				itRes = std::move_backward(itMain - mainCount, itMain, itRes);
+				itMain -= mainCount;
+				if (itMain == b)
+					break;
+
+				const Value& pivotMain = itMain[-1];
+				size_t bufCount = timSortGallopCount(ReverseBufferIterator(itBuf), ReverseBufferIterator(bufBegin),
+							[&](const Value& v) {
+					return !comparator(v, pivotMain);
+				});
+				itRes = std::move_backward(itBuf - bufCount, itBuf, itRes);
+				itBuf -= bufCount;
+
+				galloping = mainCount >= gallop || bufCount >= gallop;
+			}
+			if (adaptiveGallop)
+				++minGallop;
 		}
-	}
+		std::move_backward(bufBegin, itBuf, itRes);
 
+		destroyBuffer(bufBegin, bufEnd);
+	}
 
-	void simpleMerge(const SortIterator& b1, const SortIterator& e1,
-				const SortIterator& b2, const SortIterator& e2, const SortIterator& buffer) const {
+	static void destroyBuffer(Value* b, Value* e) {
+		for (; b < e; ++b)
+			b->~Value();
+	}
 
-		if ((e1 - b1) > (e2 - b2)) {
-			simpleMerge(b2, e2, b1, e1, buffer);
+	// Stable merge in O(1) extra memory and linear time, after GrailSort: the first occurrences of
+	// distinct values of X tag the blocks of both runs and, if there are enough of them, serve as
+	// the buffer of the merge. The keys are sorted back and merged in at the end.
+	void inplaceMerge(SortIterator b, SortIterator m, SortIterator e) const {
+		Distance blockSize = static_cast<Distance>(std::sqrt(static_cast<double>(e - b)));
+		if (std::min(m - b, e - m) <= blockSize) {
+			rotationMerge(b, m, e);
 			return;
 		}
 
-		SortIterator itMain1 = b1;
-		SortIterator itBuf = buffer;
-		while (itMain1 < e1) {
-			swapIterators(itMain1++, itBuf++);
+		// A buffer block and a tag for every block
+		Distance wantedKeys = blockSize + (e - b) / blockSize;
+		Distance keysCount = inplaceMergeExtractKeys(b, m, wantedKeys);
+		SortIterator x = b + keysCount;
+		bool withBuffer = keysCount == wantedKeys;
+		if (!withBuffer) {
+			// X has few distinct values: as many blocks as keys, merged by rotations
+			blockSize = (e - x + keysCount - 1) / keysCount;
 		}
 
-		itMain1 = buffer;
-		SortIterator itMain2 = b2;
-		SortIterator itRes = b1;
-
-		bool lastComparison = false;
-		int sameComparisonCount = -1;
-		unsigned int gallop = params.GetGallop();
-		while (itMain1 < itBuf || itMain2 < e2) {
-			if (itMain1 == itBuf) {
-				swapIterators(itRes++, itMain2++);
-			} else if (itMain2 == e2) {
-				swapIterators(itRes++, itMain1++);
-			} else {
-				bool comparison = comparator(*itMain1, *itMain2);
-				if (comparison == lastComparison && sameComparisonCount != -1) {
-					sameComparisonCount++;
-					if (sameComparisonCount == static_cast<int>(gallop)) {
-						unsigned int needCopies = comparison ?
-									findCopiesCount(itMain1, itBuf, itMain2, true) :
-									findCopiesCount(itMain2, e2, itMain1, true);
-						while (needCopies && --needCopies) {
-							swapIterators(itRes++, comparison ? itMain1++ : itMain2++);
-						}
-					}
-				} else {
-					lastComparison = comparison;
-					sameComparisonCount = 0;
-				}
-				swapIterators(itRes++, comparison ? itMain1++ : itMain2++);
-			}
-			if (itRes == e1) {
-				itRes = b2;
-			}
+		if (keysCount < 4 || m - x < blockSize || e - m < blockSize) {
+			rotationMerge(x, m, e);
+			rotationMerge(b, x, e);
+			return;
 		}
-	}
 
-	unsigned int findCopiesCount(const SortIterator& b, const SortIterator& e,
-				const SortIterator& pivot, bool expectedComparison) const {
-		unsigned int l = 0, r = 1;
-		while ((b + r) < e && comparator(b[r], *pivot) == expectedComparison) {
-			r <<= 1;
-			if (e - b <= r) {
-				r = e - b;
-				break;
-			}
+		// The blocks of X are aligned to m, the elements of X before them are merged in after
+		Distance headSize = (m - x) % blockSize;
+		SortIterator head = x;
+		if (withBuffer) {
+			head = x - blockSize;
+			std::rotate(head, x, x + headSize);
 		}
 
-		while (l < r) {
-			unsigned int m = (l + r) >> 1;
-			if (comparator(b[m], *pivot) == expectedComparison) {
-				l = m + 1;
-			} else {
-				r = m;
-			}
-		}
+		SortIterator blocks = head + headSize + (withBuffer ? blockSize : 0);
+		inplaceMergeBlocks(b, blocks, (m - blocks) / blockSize, (e - m) / blockSize, (e - m) % blockSize,
+					blockSize, withBuffer);
 
-		return l > 0 ? l - 1 : 0;
-	}
+		// The buffer has moved to the end
+		SortIterator mergedEnd = withBuffer ? e - blockSize : e;
+		rotationMerge(head, head + headSize, mergedEnd);
+		if (withBuffer)
+			std::rotate(head, mergedEnd, e);
 
-	RunController popRun() {
-		RunController rc = runStack.top();
-		runStack.pop();
-		return rc;
+		inplaceMergeSortKeys(b, x);
+		rotationMerge(b, x, e);
 	}
-	void pushRun(RunController rc) {
-		runStack.push(rc);
-	}
-
-	class RunController {
-	private:
-		SortIterator _begin, _end;
 
-	public:
-		const TimSortController<SortIterator, Comparator>& parentController;
-
-		void join(const RunController& run) {
-			_end = run._end;
+	// Moves the first occurrences of up to wanted distinct values of the sorted [b, m) to its
+	// start, in order, the other elements keep their order. Returns the count of keys found.
+	Distance inplaceMergeExtractKeys(SortIterator b, SortIterator m, Distance wanted) const {
+		TIMSORT_PHASE(TP_BlockDecomposition);
+		SortIterator keys = b;
+		Distance count = 1;
+		for (SortIterator it = b + 1; it < m && count < wanted; ++it) {
+			if (comparator(keys[count - 1], *it)) {
+				std::rotate(keys, keys + count, it);
+				keys = it - count;
+				++count;
+			}
 		}
+		std::rotate(b, keys, keys + count);
+		return count;
+	}
 
-		unsigned int size() const {
-			return static_cast<unsigned int>(_end - _begin);
+	// Keys are distinct, so the order of equal elements doesn't matter
+	void inplaceMergeSortKeys(SortIterator b, SortIterator e) const {
+		for (SortIterator it = b + 1; it < e; ++it) {
+			SortIterator t = std::upper_bound(b, it, *it, comparator);
+			if (t != it)
+				std::rotate(t, it, it + 1);
 		}
+	}
 
-		const SortIterator begin() const {
-			return _begin;
+	// countX blocks of X and countY blocks of Y start at blocks, lastSize elements of Y follow.
+	// keys[i] tags the block i, the tags of X are the smaller ones. With a buffer, blockSize
+	// elements before the blocks take the output and end up after it.
+	void inplaceMergeBlocks(SortIterator keys, SortIterator blocks, Distance countX, Distance countY,
+				Distance lastSize, Distance blockSize, bool withBuffer) const {
+		Distance count = countX + countY;
+		Distance midKey = inplaceMergeSortOfBlocks(keys, blocks, count, blockSize, countX);
+
+		// Blocks of X that go after the first of the last elements are merged with them at once
+		Distance countLastX = 0;
+		if (lastSize > 0) {
+			const SortIterator last = blocks + count * blockSize;
+			while (countLastX < count && comparator(*last, blocks[(count - countLastX - 1) * blockSize]))
+				++countLastX;
+			count -= countLastX;
 		}
-		const SortIterator end() const {
-			return _end;
+
+		// The rest of the merged blocks that can still go after the next block
+		Distance restSize = 0;
+		bool restX = true;
+		Distance next = 0;
+		if (count > 0) {
+			restSize = blockSize;
+			restX = comparator(keys[0], keys[midKey]);
+			for (next = blockSize; next < count * blockSize; next += blockSize) {
+				SortIterator rest = blocks + (next - restSize);
+				if (comparator(keys[next / blockSize], keys[midKey]) == restX) {
+					if (withBuffer)
+						inplaceMergeSwapRanges(rest - blockSize, rest, restSize);
+					restSize = blockSize;
+				} else if (withBuffer) {
+					inplaceMergeRestWithBuffer(rest, restSize, restX, blockSize);
+				} else {
+					inplaceMergeRestWithoutBuffer(rest, restSize, restX, blockSize);
+				}
+			}
 		}
 
-//		void coutRun() const {
-//			std::cout << "Run[" << _begin - parentController.begin <<
-//						", " << _end - parentController.begin << ")=" << size() << ";\n";
-//		}
-//		void coutRunContent() const {
-//			coutRun();
-//			for (SortIterator it = _begin; it < _end; ++it) {
-//				std::cout << ' ' << *it;
-//			}
-//			std::cout << '\n';
-//		}
+		SortIterator rest = blocks + (next - restSize);
+		if (lastSize == 0) {
+			if (withBuffer)
+				inplaceMergeSwapRanges(rest - blockSize, rest, restSize);
+			return;
+		}
 
-	private:
-		RunController(SortIterator begin, SortIterator end,
-				const TimSortController<SortIterator, Comparator>& parentController)
-			:_begin(begin), _end(end), parentController(parentController)
-		{}
+		if (!restX) {
+			if (withBuffer)
+				inplaceMergeSwapRanges(rest - blockSize, rest, restSize);
+			rest = blocks + next;
+		}
+		SortIterator lastBegin = blocks + (count + countLastX) * blockSize;
+		if (withBuffer)
+			inplaceMergeLeftWithBuffer(rest, lastBegin, lastBegin + lastSize, blockSize);
+		else
+			rotationMerge(rest, lastBegin, lastBegin + lastSize);
+	}
 
-		void sortRun() const {
-			for (SortIterator it = _begin + 1; it < _end; ++it) {
-				SortIterator t = it;
-				Value v = *it;
-//				std::cout << typeid(v).name() << "]]]\n";
-				while (t > _begin && !parentController.comparator(t[-1], v)) {
-					*t = *(t-1);
-					--t;
-				}
-				*t = v;
+	// Selection sort of the blocks by their first elements, equal ones in the order of the tags.
+	// Returns the new position of the tag at midKey.
+	Distance inplaceMergeSortOfBlocks(SortIterator keys, SortIterator blocks, Distance count,
+				Distance blockSize, Distance midKey) const {
+		TIMSORT_PHASE(TP_BlockDecomposition);
+		for (Distance i = 0; i + 1 < count; ++i) {
+			Distance min = i;
+			for (Distance j = i + 1; j < count; ++j) {
+				if (comparator(blocks[j * blockSize], blocks[min * blockSize]) ||
+						(!comparator(blocks[min * blockSize], blocks[j * blockSize]) && comparator(keys[j], keys[min])))
+					min = j;
+			}
+			if (min != i) {
+				inplaceMergeSwapRanges(blocks + i * blockSize, blocks + min * blockSize, blockSize);
+				swapIterators(keys + i, keys + min);
+				if (midKey == i)
+					midKey = min;
+				else if (midKey == min)
+					midKey = i;
 			}
 		}
-		void reverseRun() const {
-			SortIterator a = _begin;
-			SortIterator b = _end;
+		return midKey;
+	}
 
-			while (a < b) {
-				swapIterators(a++, --b);
-			}
+	// Merges the rest with the next block through the buffer before the rest. What is left of
+	// either goes to the end of the block and becomes the new rest.
+	void inplaceMergeRestWithBuffer(SortIterator rest, Distance& restSize, bool& restX,
+				Distance blockSize) const {
+		SortIterator out = rest - blockSize;
+		SortIterator itRest = rest, restEnd = rest + restSize;
+		SortIterator itBlock = restEnd, blockEnd = restEnd + blockSize;
+		while (itRest < restEnd && itBlock < blockEnd) {
+			bool takeRest = restX ? !comparator(*itBlock, *itRest) : comparator(*itRest, *itBlock);
+			swapIterators(out++, takeRest ? itRest++ : itBlock++);
 		}
 
-	public:
-		static void swapRuns(const RunController& a, const RunController& b) {
-			SortIterator it1 = a._begin;
-			SortIterator it2 = b._begin;
+		if (itRest < restEnd) {
+			restSize = restEnd - itRest;
+			while (itRest < restEnd)
+				swapIterators(--restEnd, --blockEnd);
+		} else {
+			restSize = blockEnd - itBlock;
+			restX = !restX;
+		}
+	}
 
-			while (it1 < a._end && it2 < b._end) {
-				swapIterators(it1++, it2++);
+	// Same merge by rotations: every round moves the elements of the block that go before the
+	// first of the rest, then skips the elements of the rest that go before the block
+	void inplaceMergeRestWithoutBuffer(SortIterator rest, Distance& restSize, bool& restX,
+				Distance blockSize) const {
+		Distance lenRest = restSize, lenBlock = blockSize;
+		bool ordered = restX ? !comparator(rest[lenRest], rest[lenRest - 1])
+					: comparator(rest[lenRest - 1], rest[lenRest]);
+		while (lenRest > 0 && !ordered) {
+			SortIterator block = rest + lenRest;
+			SortIterator cut = restX ? std::lower_bound(block, block + lenBlock, *rest, comparator)
+						: std::upper_bound(block, block + lenBlock, *rest, comparator);
+			if (cut != block) {
+				rest = std::rotate(rest, block, cut);
+				lenBlock -= cut - block;
+				if (lenBlock == 0) {
+					restSize = lenRest;
+					return;
+				}
 			}
+
+			do {
+				++rest;
+				--lenRest;
+			} while (lenRest > 0 && (restX ? !comparator(rest[lenRest], *rest) : comparator(*rest, rest[lenRest])));
 		}
-		static RunController makeRun(SortIterator start, SortIterator minPos, SortIterator finish,
-					const TimSortController<SortIterator, Comparator>& tsController) {
-			SortIterator begin = start;
-			SortIterator end = start + 1;
-			bool compareType = false;
-			bool resortFlag = false;
+		restSize = lenBlock;
+		restX = !restX;
+	}
 
-			if (end != finish) {
+	// Merges [b, m) with [m, e) through the buffer of bufferSize >= e - m elements before b,
+	// which ends up after the output
+	void inplaceMergeLeftWithBuffer(SortIterator b, SortIterator m, SortIterator e, Distance bufferSize) const {
+		SortIterator out = b - bufferSize, itX = b, itY = m;
+		while (itY < e) {
+			if (itX == m || comparator(*itY, *itX))
+				swapIterators(out++, itY++);
+			else
+				swapIterators(out++, itX++);
+		}
+		inplaceMergeSwapRanges(out, itX, m - itX);
+	}
 
-				compareType = tsController.comparator(*end, *start);
-				++end;
+	// Element by element, so a range can be moved into an overlapping one on its left
+	static void inplaceMergeSwapRanges(SortIterator a, SortIterator b, Distance count) {
+		for (Distance i = 0; i < count; ++i)
+			swapIterators(a + i, b + i);
+	}
 
-				while (end < finish && tsController.comparator(end[0], end[-1]) == compareType) {
-					++end;
-				}
-				while (end < minPos && end < finish) {
-					++end;
-					resortFlag = true;
+	// Stable merge by rotations, iterating over the shorter run: every round takes at least one
+	// value of each run, so it moves the longer run once and the shorter one at most as many
+	// times as the runs have distinct values
+	void rotationMerge(SortIterator b, SortIterator m, SortIterator e) const {
+		if (m - b <= e - m) {
+			while (b < m) {
+				// Elements of Y less than X[0] go before it
+				SortIterator cut = std::lower_bound(m, e, *b, comparator);
+				if (cut != m) {
+					b = std::rotate(b, m, cut);
+					m = cut;
 				}
+				if (m == e)
+					return;
 
+				// Elements of X not greater than Y[0] are in place
+				do {
+					++b;
+				} while (b < m && !comparator(*m, *b));
 			}
+		} else {
+			while (m < e) {
+				// Elements of X greater than Y[last] go after it
+				SortIterator cut = std::upper_bound(b, m, e[-1], comparator);
+				if (cut != m) {
+					e = std::rotate(cut, m, e);
+					m = cut;
+				}
+				if (b == m)
+					return;
 
-			RunController controller(begin, end, tsController);
-			if (resortFlag)
-				controller.sortRun();
-			else if (compareType)
-				controller.reverseRun();
-
-			return controller;
-		}
-		static RunController* getUnsortedRunPointer(SortIterator start, SortIterator finish,
-					const TimSortController<SortIterator, Comparator>& tsController) {
-			return new RunController(start, finish, tsController);
+				// Elements of Y not less than X[last] are in place
+				do {
+					--e;
+				} while (m < e && !comparator(e[-1], m[-1]));
+			}
 		}
-	};
+	}
 
-	template <class T>
-	static void swap(T& a, T& b) {
-		T t = a;
-		a = b;
-		b = t;
+	RunController popRun() {
+		return runStack[--runsCount];
+	}
+	void pushRun(const RunController& rc) {
+		runStack[runsCount++] = rc;
 	}
+
 	static void swapIterators(SortIterator a, SortIterator b) {
-		swap(*a, *b);
+		std::iter_swap(a, b);
 	}
 
 
 public:
 	static void sort(SortIterator begin, SortIterator end,
-			const Comparator& comparator, const ITimSortParams& params = DefaultTimSortParams()) {
+			const Comparator& comparator, const Params& params) {
 
 		if (begin == end)
 			return;
 
+		unsigned int threadsCount = params.GetThreadsCount();
+		if (threadsCount > 1 && static_cast<size_t>(end - begin) >= PARALLEL_MIN_SIZE) {
+			TimSortThreadPool pool(threadsCount - 1);
+			sort(begin, end, comparator, params, pool);
+			return;
+		}
+
 		TimSortController controller(begin, end, comparator, params);
 		controller.sort();
 	}
 
+	// [begin, middle) gets the middle - begin smallest elements in sorted order, equal ones in
+	// their original order; the rest of the range is left in unspecified order
+	static void partialSort(SortIterator begin, SortIterator middle, SortIterator end,
+			const Comparator& comparator, const Params& params) {
+
+		if (begin == middle)
+			return;
+
+		if (middle == end) {
+			sort(begin, end, comparator, params);
+			return;
+		}
+
+		TimSortController controller(begin, end, comparator, params);
+		controller.partialSort(static_cast<size_t>(middle - begin));
+	}
+
+	// [begin, sortedEnd) is sorted already: it is taken as one run without a scan, the tail is
+	// sorted on its own and merged into it, galloping over the parts that stay in place
+	static void append(SortIterator begin, SortIterator sortedEnd, SortIterator end,
+			const Comparator& comparator, const Params& params) {
+
+		if (sortedEnd == end)
+			return;
+
+		sort(sortedEnd, end, comparator, params);
+		merge(begin, sortedEnd, end, comparator, params);
+	}
+
+	// Stable merge of the sorted runs [begin, middle) and [middle, end)
+	static void merge(SortIterator begin, SortIterator middle, SortIterator end,
+			const Comparator& comparator, const Params& params) {
+
+		if (begin == middle || middle == end)
+			return;
+
+		TimSortController controller(begin, end, comparator, params);
+		RunController x(begin, middle), y(middle, end);
+		controller.mergeRuns(x, y);
+	}
+
+	// Must be called from outside of the pool threads
 	static void sort(SortIterator begin, SortIterator end,
-			const ITimSortParams& params = DefaultTimSortParams()) {
-		sort(begin, end, Comparator(), params);
+			const Comparator& comparator, const Params& params, TimSortThreadPool& pool) {
+
+		if (begin == end)
+			return;
+
+		if (pool.threadsCount() == 1 || static_cast<size_t>(end - begin) < PARALLEL_MIN_SIZE) {
+			TimSortController controller(begin, end, comparator, params);
+			controller.sort();
+			return;
+		}
+
+		TimSortController controller(begin, end, comparator, params, &pool);
+		controller.sortInParallel();
 	}
 };
@@ -0,0 +1,272 @@
+#include <iterator>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+
+
+// Projections that are cheaper to call again than to cache; TimSortByKey compares through
+// them directly. Specialize for other cheap key functions.
+template <class KeyFunction>
+struct TimSortCheapKey {
+	static const bool value = std::is_member_object_pointer<KeyFunction>::value;
+};
+
+
+// The first 8 bytes of a string as a big-endian number: a smaller prefix means a smaller
+// string, equal prefixes tell nothing
+class StringPrefix {
+public:
+	uint64_t operator ()(const std::string& s) const {
+		uint64_t prefix = 0;
+		for (size_t i = 0; i < 8; ++i)
+			prefix = (prefix << 8) | (i < s.size() ? static_cast<unsigned char>(s[i]) : 0);
+		return prefix;
+	}
+	uint64_t operator ()(const std::string* s) const {
+		return (*this)(*s);
+	}
+};
+
+
+template <class KeyFunction, class Value>
+auto projectKey(const KeyFunction& keyFunction, const Value& v)
+			-> typename std::enable_if<std::is_member_object_pointer<KeyFunction>::value,
+				decltype(v.*keyFunction)>::type {
+	return v.*keyFunction;
+}
+
+template <class KeyFunction, class Value>
+auto projectKey(const KeyFunction& keyFunction, const Value& v)
+			-> typename std::enable_if<!std::is_member_object_pointer<KeyFunction>::value,
+				decltype(keyFunction(v))>::type {
+	return keyFunction(v);
+}
+
+
+// Cycle leader: position i takes the element that was at sources[i], every element moves
+// once. The permutation itself is not changed, visited positions are kept in a bitmap.
+template <class RandomAccessIterator, class IndexIterator>
+void applyPermutation(RandomAccessIterator first, IndexIterator sourcesFirst, IndexIterator sourcesLast) {
+	typedef typename std::iterator_traits<RandomAccessIterator>::value_type Value;
+
+	size_t count = static_cast<size_t>(sourcesLast - sourcesFirst);
+	std::vector<bool> placed(count, false);
+	for (size_t i = 0; i < count; ++i) {
+		if (placed[i] || static_cast<size_t>(sourcesFirst[i]) == i)
+			continue;
+
+		Value cycleValue = std::move(first[i]);
+		size_t j = i;
+		while (static_cast<size_t>(sourcesFirst[j]) != i) {
+			size_t next = static_cast<size_t>(sourcesFirst[j]);
+			first[j] = std::move(first[next]);
+			placed[j] = true;
+			j = next;
+		}
+		first[j] = std::move(cycleValue);
+		placed[j] = true;
+	}
+}
+
+
+template <class Key, class Payload>
+struct KeyedItem {
+	Key key;
+	Payload payload;
+
+	KeyedItem(Key&& key, Payload&& payload)
+		:key(std::move(key)), payload(std::move(payload))
+	{}
+};
+
+
+template <class SortIterator>
+class KeySortController {
+private:
+	typedef typename std::iterator_traits<SortIterator>::value_type Value;
+
+	template <class KeyFunction>
+	struct KeyOf {
+		typedef typename std::decay<decltype(projectKey(std::declval<const KeyFunction&>(),
+					std::declval<const Value&>()))>::type type;
+	};
+
+	// Small values travel with their keys, others are permuted after the sort
+	static const bool MOVE_VALUES = std::is_trivially_copyable<Value>::value &&
+				sizeof(Value) <= 2 * sizeof(void*);
+
+	template <class KeyFunction, class KeyComparator>
+	class ProjectionComparator {
+	private:
+		const KeyFunction keyFunction;
+		const KeyComparator comparator;
+
+	public:
+		ProjectionComparator(const KeyFunction& keyFunction, const KeyComparator& comparator)
+			:keyFunction(keyFunction), comparator(comparator)
+		{}
+
+		bool operator ()(const Value& a, const Value& b) const {
+			return comparator(projectKey(keyFunction, a), projectKey(keyFunction, b));
+		}
+	};
+
+	template <class Key, class Payload, class KeyComparator>
+	class ItemComparator {
+	private:
+		const KeyComparator comparator;
+
+	public:
+		ItemComparator(const KeyComparator& comparator)
+			:comparator(comparator)
+		{}
+
+		bool operator ()(const KeyedItem<Key, Payload>& a, const KeyedItem<Key, Payload>& b) const {
+			return comparator(a.key, b.key);
+		}
+	};
+
+	// Prefixes decide first, the comparator only breaks their ties
+	template <class Prefix, class Comparator>
+	class PrefixComparator {
+	private:
+		const Comparator comparator;
+
+	public:
+		PrefixComparator(const Comparator& comparator)
+			:comparator(comparator)
+		{}
+
+		bool operator ()(const KeyedItem<Prefix, Value>& a, const KeyedItem<Prefix, Value>& b) const {
+			if (a.key != b.key)
+				return a.key < b.key;
+			return comparator(a.payload, b.payload);
+		}
+	};
+
+	template <class Comparator>
+	class IndexComparator {
+	private:
+		const SortIterator first;
+		const Comparator comparator;
+
+	public:
+		IndexComparator(const SortIterator& first, const Comparator& comparator)
+			:first(first), comparator(comparator)
+		{}
+
+		template <class Index>
+		bool operator ()(Index a, Index b) const {
+			return comparator(first[a], first[b]);
+		}
+	};
+
+	template <class Iterator, class Comparator>
+	static void sortRange(Iterator first, Iterator last, const Comparator& comparator) {
+		TimSortController<Iterator, Comparator, DefaultTimSortPolicy>::sort(
+					first, last, comparator, DefaultTimSortPolicy());
+	}
+
+	// Cheap keys are compared through the projection
+	template <class KeyFunction, class KeyComparator>
+	static void sortByKey(SortIterator first, SortIterator last,
+				const KeyFunction& keyFunction, const KeyComparator& comparator, std::true_type) {
+		sortRange(first, last, ProjectionComparator<KeyFunction, KeyComparator>(keyFunction, comparator));
+	}
+
+	template <class KeyFunction, class KeyComparator>
+	static void sortByKey(SortIterator first, SortIterator last,
+				const KeyFunction& keyFunction, const KeyComparator& comparator, std::false_type) {
+		sortByCachedKey(first, last, keyFunction, comparator, std::integral_constant<bool, MOVE_VALUES>());
+	}
+
+	template <class KeyFunction, class KeyComparator>
+	static void sortByCachedKey(SortIterator first, SortIterator last,
+				const KeyFunction& keyFunction, const KeyComparator& comparator, std::true_type) {
+		typedef typename KeyOf<KeyFunction>::type Key;
+
+		std::vector<KeyedItem<Key, Value>> items;
+		items.reserve(static_cast<size_t>(last - first));
+		for (SortIterator it = first; it < last; ++it)
+			items.emplace_back(Key(projectKey(keyFunction, *it)), std::move(*it));
+
+		sortRange(items.begin(), items.end(), ItemComparator<Key, Value, KeyComparator>(comparator));
+
+		for (size_t i = 0; i < items.size(); ++i)
+			first[i] = std::move(items[i].payload);
+	}
+
+	template <class KeyFunction, class KeyComparator>
+	static void sortByCachedKey(SortIterator first, SortIterator last,
+				const KeyFunction& keyFunction, const KeyComparator& comparator, std::false_type) {
+		if (static_cast<size_t>(last - first) <= UINT32_MAX)
+			sortByIndices<uint32_t>(first, last, keyFunction, comparator);
+		else
+			sortByIndices<size_t>(first, last, keyFunction, comparator);
+	}
+
+	// Keys are sorted with the positions of their elements, which then move once each
+	template <class Index, class KeyFunction, class KeyComparator>
+	static void sortByIndices(SortIterator first, SortIterator last,
+				const KeyFunction& keyFunction, const KeyComparator& comparator) {
+		typedef typename KeyOf<KeyFunction>::type Key;
+
+		std::vector<KeyedItem<Key, Index>> items;
+		items.reserve(static_cast<size_t>(last - first));
+		for (SortIterator it = first; it < last; ++it)
+			items.emplace_back(Key(projectKey(keyFunction, *it)), static_cast<Index>(it - first));
+
+		sortRange(items.begin(), items.end(), ItemComparator<Key, Index, KeyComparator>(comparator));
+
+		std::vector<Index> sources(items.size());
+		for (size_t i = 0; i < items.size(); ++i)
+			sources[i] = items[i].payload;
+		std::vector<KeyedItem<Key, Index>>().swap(items);
+
+		applyPermutation(first, sources.begin(), sources.end());
+	}
+
+public:
+	template <class KeyFunction, class KeyComparator>
+	static void sortByKey(SortIterator first, SortIterator last,
+				const KeyFunction& keyFunction, const KeyComparator& comparator) {
+		if (first == last)
+			return;
+
+		sortByKey(first, last, keyFunction, comparator,
+					std::integral_constant<bool, TimSortCheapKey<KeyFunction>::value>());
+	}
+
+	template <class PrefixFunction, class Comparator>
+	static void sortByPrefix(SortIterator first, SortIterator last,
+				const PrefixFunction& prefixFunction, const Comparator& comparator) {
+		typedef typename std::decay<decltype(prefixFunction(std::declval<const Value&>()))>::type Prefix;
+
+		std::vector<KeyedItem<Prefix, Value>> items;
+		items.reserve(static_cast<size_t>(last - first));
+		for (SortIterator it = first; it < last; ++it)
+			items.emplace_back(Prefix(prefixFunction(*it)), std::move(*it));
+
+		sortRange(items.begin(), items.end(), PrefixComparator<Prefix, Comparator>(comparator));
+
+		for (size_t i = 0; i < items.size(); ++i)
+			first[i] = std::move(items[i].payload);
+	}
+
+	// indices gets the positions of the elements in sorted order; the elements stay in place
+	template <class IndexIterator, class Comparator>
+	static void sortIndices(SortIterator first, SortIterator last, IndexIterator indices,
+				const Comparator& comparator) {
+		typedef typename std::iterator_traits<IndexIterator>::value_type Index;
+
+		size_t count = static_cast<size_t>(last - first);
+		for (size_t i = 0; i < count; ++i)
+			indices[i] = static_cast<Index>(i);
+
+		sortRange(indices, indices + count, IndexComparator<Comparator>(first, comparator));
+	}
+};
@@ -0,0 +1,216 @@
+#include <iterator>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+
+// Tournament of sorted sources: every inner node keeps the source that lost the match there,
+// losers[0] keeps the overall winner. Taking an element replays the matches on the path of
+// its source only, about log2(k) comparisons. Equal elements are taken from the earlier
+// source first; exhausted sources lose every match.
+template <class RandomAccessIterator, class Comparator, bool MoveElements = false>
+class LoserTree {
+private:
+	typedef typename std::conditional<MoveElements,
+				std::move_iterator<RandomAccessIterator>, RandomAccessIterator>::type TransferIterator;
+	typedef typename std::iterator_traits<RandomAccessIterator>::value_type Value;
+
+	struct Source {
+		RandomAccessIterator next, end;
+	};
+
+	const Comparator& comparator;
+	std::vector<Source> sources;
+	std::vector<unsigned int> losers;
+
+	bool exhausted(unsigned int source) const {
+		return sources[source].next == sources[source].end;
+	}
+
+	bool beats(unsigned int a, unsigned int b) const {
+		if (exhausted(a))
+			return false;
+		if (exhausted(b))
+			return true;
+
+		const RandomAccessIterator& x = sources[a].next;
+		const RandomAccessIterator& y = sources[b].next;
+		return comparator(*x, *y) || (a < b && !comparator(*y, *x));
+	}
+
+	// Leaves are nodes k..2k-1, so node n has children 2n and 2n+1 for any k
+	unsigned int build(unsigned int node) {
+		unsigned int k = static_cast<unsigned int>(sources.size());
+		if (node >= k)
+			return node - k;
+
+		unsigned int a = build(2 * node);
+		unsigned int b = build(2 * node + 1);
+		if (beats(a, b)) {
+			losers[node] = b;
+			return a;
+		}
+		losers[node] = a;
+		return b;
+	}
+
+	void replay(unsigned int source) {
+		unsigned int winner = source;
+		for (unsigned int node = (source + static_cast<unsigned int>(sources.size())) / 2; node > 0; node /= 2) {
+			if (beats(losers[node], winner))
+				std::swap(losers[node], winner);
+		}
+		losers[0] = winner;
+	}
+
+	// The second best source has lost to the winner on its path; k if there is none
+	unsigned int runnerUp() const {
+		unsigned int k = static_cast<unsigned int>(sources.size());
+		unsigned int best = k;
+		for (unsigned int node = (losers[0] + k) / 2; node > 0; node /= 2) {
+			if (best == k || beats(losers[node], best))
+				best = losers[node];
+		}
+		return best;
+	}
+
+public:
+	LoserTree(const Comparator& comparator)
+		:comparator(comparator)
+	{}
+
+	void addSource(RandomAccessIterator begin, RandomAccessIterator end) {
+		if (begin != end) {
+			Source source = {begin, end};
+			sources.push_back(source);
+		}
+	}
+
+	// Once a source wins gallop times in a row, all of its elements that beat the runner-up
+	// are found with timSortGallopCount and taken at once
+	template <class OutputIterator>
+	OutputIterator merge(OutputIterator out, unsigned int gallop) {
+		if (sources.empty())
+			return out;
+
+		TIMSORT_PHASE(TP_Merge);
+		losers.resize(sources.size());
+		losers[0] = build(1);
+
+		unsigned int streak = 0, lastWinner = 0;
+		while (!exhausted(losers[0])) {
+			unsigned int winner = losers[0];
+			Source& source = sources[winner];
+			*out = *TransferIterator(source.next);
+			++out;
+			++source.next;
+
+			streak = winner == lastWinner ? streak + 1 : 1;
+			lastWinner = winner;
+			if (streak >= gallop && !exhausted(winner)) {
+				unsigned int second = runnerUp();
+				size_t count = static_cast<size_t>(source.end - source.next);
+				if (second < sources.size() && !exhausted(second)) {
+					const RandomAccessIterator& pivot = sources[second].next;
+					bool earlier = winner < second;
+					count = timSortGallopCount(source.next, source.end, [&](const Value& v) {
+						return earlier ? !comparator(*pivot, v) : comparator(v, *pivot);
+					});
+				}
+				out = std::copy(TransferIterator(source.next), TransferIterator(source.next + count), out);
+				source.next += count;
+				streak = 0;
+			}
+
+			replay(winner);
+		}
+		return out;
+	}
+};
+
+
+// Merges many sorted ranges at once with a LoserTree: every element moves once instead of
+// log2(k) times through pairwise merges
+template <class RandomAccessIterator, class Comparator, class Params>
+class KWayMergeController {
+private:
+	typedef typename std::iterator_traits<RandomAccessIterator>::value_type Value;
+
+	// Moves the runs [bounds[i], bounds[i + 1]) to the buffer and merges them back
+	static void mergeThroughBuffer(const RandomAccessIterator* bounds, size_t runsCount,
+				MergeBuffer<Value>& buffer, const Comparator& comparator, const Params& params) {
+		RandomAccessIterator first = bounds[0];
+		RandomAccessIterator last = bounds[runsCount];
+		Value* const bufBegin = buffer.get();
+		Value* bufEnd = bufBegin;
+		for (RandomAccessIterator it = first; it < last; ++it, ++bufEnd)
+			new (bufEnd) Value(std::move(*it));
+
+		LoserTree<Value*, Comparator, true> tree(comparator);
+		for (size_t i = 0; i < runsCount; ++i)
+			tree.addSource(bufBegin + (bounds[i] - first), bufBegin + (bounds[i + 1] - first));
+		tree.merge(first, params.GetGallop());
+
+		for (Value* it = bufBegin; it < bufEnd; ++it)
+			it->~Value();
+	}
+
+public:
+	// ranges is a sequence of pairs of iterators; the elements are copied to out
+	template <class Ranges, class OutputIterator>
+	static OutputIterator merge(const Ranges& ranges, OutputIterator out,
+				const Comparator& comparator, const Params& params) {
+		LoserTree<RandomAccessIterator, Comparator> tree(comparator);
+		for (typename Ranges::const_iterator it = ranges.begin(); it != ranges.end(); ++it)
+			tree.addSource(it->first, it->second);
+		return tree.merge(out, params.GetGallop());
+	}
+
+	// [first, last) is made of sorted runs that start at first and at every bound. Consecutive
+	// runs that fit the buffer budget together are merged k-way through the buffer; the runs
+	// left are merged pairwise, level by level, by TimSortController.
+	template <class RunBounds>
+	static void mergeInPlace(RandomAccessIterator first, RandomAccessIterator last, const RunBounds& runBounds,
+				const Comparator& comparator, const Params& params) {
+		std::vector<RandomAccessIterator> bounds(1, first);
+		for (typename RunBounds::const_iterator it = runBounds.begin(); it != runBounds.end(); ++it) {
+			if (*it != bounds.back() && *it != last)
+				bounds.push_back(*it);
+		}
+		bounds.push_back(last);
+
+		MergeBuffer<Value> buffer;
+		size_t budgetCount = params.GetBufferBudget() / sizeof(Value);
+		std::vector<RandomAccessIterator> merged(1, first);
+		for (size_t i = 0; i + 1 < bounds.size(); ) {
+			size_t j = i + 1;
+			while (j + 1 < bounds.size() && static_cast<size_t>(bounds[j + 1] - bounds[i]) <= budgetCount)
+				++j;
+
+			if (j - i > 1 && buffer.reserve(static_cast<size_t>(bounds[j] - bounds[i]), params.GetBufferBudget()))
+				mergeThroughBuffer(&bounds[i], j - i, buffer, comparator, params);
+			else
+				j = i + 1;
+
+			merged.push_back(bounds[j]);
+			i = j;
+		}
+
+		typedef TimSortController<RandomAccessIterator, Comparator, Params> Controller;
+		while (merged.size() > 2) {
+			std::vector<RandomAccessIterator> next(1, first);
+			for (size_t i = 0; i + 1 < merged.size(); i += 2) {
+				if (i + 2 < merged.size()) {
+					Controller::merge(merged[i], merged[i + 1], merged[i + 2], comparator, params);
+					next.push_back(merged[i + 2]);
+				} else {
+					next.push_back(merged[i + 1]);
+				}
+			}
+			merged.swap(next);
+		}
+	}
+};
@@ -0,0 +1,156 @@
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <memory>
+
+
+
+// Work-stealing fork-join pool. Thread i owns queue i: it pushes and pops tasks at the back,
+// idle threads steal from the front of other queues. Queue 0 belongs to the thread that
+// calls into the pool from outside, the pool starts workersCount more threads.
+class TimSortThreadPool {
+private:
+	struct Task {
+		std::function<void (unsigned int)> run;
+		std::atomic<unsigned int>* pending;
+	};
+
+	struct TaskQueue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	const unsigned int queuesCount;
+	std::unique_ptr<TaskQueue[]> queues;
+	std::vector<std::thread> workers;
+
+	std::mutex sleepMutex;
+	std::condition_variable wakeUp;
+	std::atomic<unsigned int> queuedTasks;
+	bool stopping;
+
+	TimSortThreadPool(const TimSortThreadPool&);
+	TimSortThreadPool& operator =(const TimSortThreadPool&);
+
+	// With group set only a task of that group is taken
+	bool popOwn(unsigned int worker, Task& task, const std::atomic<unsigned int>* group) {
+		TaskQueue& queue = queues[worker];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty() || (group != nullptr && queue.tasks.back().pending != group))
+			return false;
+
+		task = std::move(queue.tasks.back());
+		queue.tasks.pop_back();
+		--queuedTasks;
+		return true;
+	}
+
+	bool steal(unsigned int worker, Task& task) {
+		for (unsigned int i = 1; i < queuesCount; ++i) {
+			TaskQueue& queue = queues[(worker + i) % queuesCount];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (queue.tasks.empty())
+				continue;
+
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+			--queuedTasks;
+			return true;
+		}
+		return false;
+	}
+
+	static void execute(Task& task, unsigned int worker) {
+		task.run(worker);
+		--*task.pending;
+	}
+
+	void workerLoop(unsigned int worker) {
+		while (true) {
+			Task task;
+			if (popOwn(worker, task, nullptr) || steal(worker, task)) {
+				execute(task, worker);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			wakeUp.wait(lock, [&]() {
+				return stopping || queuedTasks > 0;
+			});
+			if (stopping)
+				return;
+		}
+	}
+
+	void helpUntilDone(unsigned int worker, std::atomic<unsigned int>& pending, bool groupOnly) {
+		while (pending > 0) {
+			Task task;
+			if (popOwn(worker, task, groupOnly ? &pending : nullptr) || (!groupOnly && steal(worker, task)))
+				execute(task, worker);
+			else
+				std::this_thread::yield();
+		}
+	}
+
+public:
+	explicit TimSortThreadPool(unsigned int workersCount)
+		:queuesCount(workersCount + 1), queues(new TaskQueue[workersCount + 1]),
+		 queuedTasks(0), stopping(false) {
+		for (unsigned int i = 1; i <= workersCount; ++i)
+			workers.push_back(std::thread(&TimSortThreadPool::workerLoop, this, i));
+	}
+
+	unsigned int threadsCount() const {
+		return queuesCount;
+	}
+
+	// Queues task for any thread; task gets the index of the thread that runs it
+	void spawn(unsigned int worker, const std::function<void (unsigned int)>& task,
+				std::atomic<unsigned int>& pending) {
+		++pending;
+		{
+			std::lock_guard<std::mutex> lock(queues[worker].mutex);
+			Task queued = {task, &pending};
+			queues[worker].tasks.push_back(std::move(queued));
+		}
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			++queuedTasks;
+		}
+		wakeUp.notify_one();
+	}
+
+	// Runs other tasks, own or stolen, until everything spawned with pending is finished
+	void wait(unsigned int worker, std::atomic<unsigned int>& pending) {
+		helpUntilDone(worker, pending, false);
+	}
+
+	// Calls task(i) for every i in [0, count) and returns when all calls are finished. While
+	// waiting the thread only runs calls of this loop, so the caller may keep state busy.
+	void parallelFor(unsigned int worker, unsigned int count, const std::function<void (unsigned int)>& task) {
+		std::atomic<unsigned int> pending(0);
+		for (unsigned int i = 1; i < count; ++i) {
+			spawn(worker, [&task, i](unsigned int) {
+				task(i);
+			}, pending);
+		}
+		if (count > 0)
+			task(0);
+
+		helpUntilDone(worker, pending, true);
+	}
+
+	~TimSortThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			stopping = true;
+		}
+		wakeUp.notify_all();
+		for (unsigned int i = 0; i < workers.size(); ++i)
+			workers[i].join();
+	}
+};
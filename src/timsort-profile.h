@@ -0,0 +1,215 @@
+#include <cstdint>
+#include <atomic>
+
+
+
+// Hardware counters of the phases of a sort, summed over all threads. Built with
+// TIMSORT_PROFILE defined on Linux, every phase switch reads the counters of the calling thread
+// through perf_event_open; otherwise TIMSORT_PHASE is empty and nothing is counted. A read is a
+// system call, so phases are coarse: the run formation loop, a merge of two runs, a k-way merge,
+// a galloping mode.
+enum ETimSortPhase {
+	TP_RunFormation,       // run formation loops, with the run stack bookkeeping between merges
+	TP_Merge,              // merges of two runs and the loser tree, with the gallops that trim runs
+	TP_Gallop,             // galloping modes of the buffered merges, from entering to leaving
+	TP_InplaceMerge,       // block merges of the runs that don't fit the buffer budget
+	TP_BlockDecomposition, // key extraction and selection sort of the blocks of in-place merges
+	TP_Radix,              // radix sort of inputs with too little order
+	TP_PhasesCount,
+	TP_None = TP_PhasesCount
+};
+
+enum ETimSortCounter {
+	TC_Cycles,
+	TC_Instructions,
+	TC_BranchMisses,
+	TC_LlcMisses,
+	TC_CountersCount
+};
+
+struct TimSortPhaseCounters {
+	uint64_t values[TC_CountersCount];
+};
+
+inline const char* timSortPhaseName(ETimSortPhase phase) {
+	static const char* const names[TP_PhasesCount] = {
+		"run formation", "merge", "gallop", "in-place merge", "block decomposition", "radix"
+	};
+	return phase < TP_PhasesCount ? names[phase] : "none";
+}
+
+
+#if defined(TIMSORT_PROFILE) && defined(__linux__)
+
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+class TimSortProfiler {
+private:
+	// One counter group per thread, opened on the first phase of the thread. User space only:
+	// the reads themselves are not counted. Counters the machine lacks stay at zero.
+	class ThreadCounters {
+	private:
+		int fds[TC_CountersCount];
+		int slots[TC_CountersCount]; // position of a counter in a group read, -1 if not opened
+		unsigned int opened;
+		uint64_t last[TC_CountersCount];
+
+		static int open(uint64_t config, int groupFd) {
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = config;
+			attr.read_format = PERF_FORMAT_GROUP;
+			attr.disabled = groupFd < 0;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0));
+		}
+
+	public:
+		ETimSortPhase current;
+
+		ThreadCounters()
+			:opened(0), current(TP_None) {
+			static const uint64_t configs[TC_CountersCount] = {
+				PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+				PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES
+			};
+			for (unsigned int i = 0; i < TC_CountersCount; ++i) {
+				fds[i] = i == 0 || fds[0] >= 0 ? open(configs[i], i == 0 ? -1 : fds[0]) : -1;
+				slots[i] = fds[i] >= 0 ? static_cast<int>(opened++) : -1;
+				last[i] = 0;
+			}
+
+			if (available()) {
+				ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+				read(last);
+			}
+		}
+
+		bool available() const {
+			return opened > 0;
+		}
+
+		bool read(uint64_t* values) const {
+			uint64_t group[1 + TC_CountersCount] = {};
+			if (::read(fds[0], group, sizeof(group)) <= 0)
+				return false;
+			for (unsigned int i = 0; i < TC_CountersCount; ++i)
+				values[i] = slots[i] >= 0 ? group[1 + slots[i]] : 0;
+			return true;
+		}
+
+		// Counts since the previous switch go to the phase that ends; if the read fails, they go
+		// to the next phase that ends with a successful read
+		void switchTo(ETimSortPhase phase) {
+			uint64_t now[TC_CountersCount];
+			if (read(now)) {
+				if (current != TP_None) {
+					for (unsigned int i = 0; i < TC_CountersCount; ++i)
+						total(current, static_cast<ETimSortCounter>(i)) += now[i] - last[i];
+				}
+				std::memcpy(last, now, sizeof(last));
+			}
+			current = phase;
+		}
+
+		~ThreadCounters() {
+			for (unsigned int i = 0; i < TC_CountersCount; ++i) {
+				if (fds[i] >= 0)
+					close(fds[i]);
+			}
+		}
+	};
+
+	static ThreadCounters& threadCounters() {
+		static thread_local ThreadCounters counters;
+		return counters;
+	}
+
+	static std::atomic<uint64_t>& total(ETimSortPhase phase, ETimSortCounter counter) {
+		static std::atomic<uint64_t> totals[TP_PhasesCount][TC_CountersCount];
+		return totals[phase][counter];
+	}
+
+public:
+	static const bool enabled = true;
+
+	// Whether the counters can be opened on the calling thread (perf_event_paranoid allows it)
+	static bool available() {
+		return threadCounters().available();
+	}
+
+	// Returns the phase that was current on the calling thread
+	static ETimSortPhase enter(ETimSortPhase phase) {
+		ThreadCounters& counters = threadCounters();
+		ETimSortPhase previous = counters.current;
+		if (counters.available() && phase != previous)
+			counters.switchTo(phase);
+		else
+			counters.current = phase;
+		return previous;
+	}
+
+	static void reset() {
+		for (unsigned int p = 0; p < TP_PhasesCount; ++p) {
+			for (unsigned int c = 0; c < TC_CountersCount; ++c)
+				total(static_cast<ETimSortPhase>(p), static_cast<ETimSortCounter>(c)) = 0;
+		}
+	}
+
+	static TimSortPhaseCounters counters(ETimSortPhase phase) {
+		TimSortPhaseCounters res;
+		for (unsigned int c = 0; c < TC_CountersCount; ++c)
+			res.values[c] = total(phase, static_cast<ETimSortCounter>(c));
+		return res;
+	}
+};
+
+// The phase lasts until the end of the scope, an enclosing phase resumes after it
+class TimSortPhaseScope {
+private:
+	const ETimSortPhase previous;
+
+	TimSortPhaseScope(const TimSortPhaseScope&);
+	TimSortPhaseScope& operator =(const TimSortPhaseScope&);
+
+public:
+	explicit TimSortPhaseScope(ETimSortPhase phase)
+		:previous(TimSortProfiler::enter(phase))
+	{}
+
+	~TimSortPhaseScope() {
+		TimSortProfiler::enter(previous);
+	}
+};
+
+#define TIMSORT_PHASE(phase) TimSortPhaseScope timSortPhaseScope(phase)
+
+#else
+
+class TimSortProfiler {
+public:
+	static const bool enabled = false;
+
+	static bool available() {
+		return false;
+	}
+
+	static void reset() {
+	}
+
+	static TimSortPhaseCounters counters(ETimSortPhase) {
+		TimSortPhaseCounters res = {};
+		return res;
+	}
+};
+
+#define TIMSORT_PHASE(phase)
+
+#endif
@@ -0,0 +1,131 @@
+#include <iterator>
+#include <type_traits>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+
+
+template <unsigned int size>
+struct RadixKeyType {
+};
+template <>
+struct RadixKeyType<1> {
+	typedef uint8_t type;
+};
+template <>
+struct RadixKeyType<2> {
+	typedef uint16_t type;
+};
+template <>
+struct RadixKeyType<4> {
+	typedef uint32_t type;
+};
+template <>
+struct RadixKeyType<8> {
+	typedef uint64_t type;
+};
+
+
+// LSD radix sort by bytes for integers, floats and doubles under std::less (order 1) or
+// std::greater (order -1). Every value is mapped to an unsigned key in the order of the
+// comparator; -0.0 gets the key of 0.0, so equal values stay in place as in a stable sort.
+template <class Value, int order, bool enabled = order != 0 && !std::is_same<Value, bool>::value &&
+	((std::is_integral<Value>::value && sizeof(Value) <= 8) ||
+	 std::is_same<Value, float>::value || std::is_same<Value, double>::value)>
+class RadixSort {
+public:
+	static const bool supported = false;
+
+	template <class SortIterator>
+	static bool sort(SortIterator, SortIterator, Value*) {
+		return false;
+	}
+};
+
+template <class Value, int order>
+class RadixSort<Value, order, true> {
+private:
+	typedef typename RadixKeyType<sizeof(Value)>::type Key;
+
+	static const unsigned int DIGITS = sizeof(Key);
+	static const unsigned int RADIX = 256;
+	static const Key SIGN_BIT = static_cast<Key>(Key(1) << (8 * sizeof(Key) - 1));
+
+	static Key orderedKey(Value v, std::true_type) {
+		Value canonical = v == 0 ? Value(0) : v;
+		Key bits;
+		std::memcpy(&bits, &canonical, sizeof(Key));
+		return (bits & SIGN_BIT) ? static_cast<Key>(~bits) : static_cast<Key>(bits | SIGN_BIT);
+	}
+	static Key orderedKey(Value v, std::false_type) {
+		return std::is_signed<Value>::value ? static_cast<Key>(static_cast<Key>(v) ^ SIGN_BIT) : static_cast<Key>(v);
+	}
+
+	static bool isNaN(Value v, std::true_type) {
+		return v != v;
+	}
+	static bool isNaN(Value, std::false_type) {
+		return false;
+	}
+
+	static Key key(Value v) {
+		Key k = orderedKey(v, std::is_floating_point<Value>());
+		return order > 0 ? k : static_cast<Key>(~k);
+	}
+
+	static unsigned int digit(Value v, unsigned int d) {
+		return static_cast<unsigned int>(key(v) >> (8 * d)) & (RADIX - 1);
+	}
+
+	template <class From, class To>
+	static void scatter(From first, From last, To target, size_t* offsets, unsigned int d) {
+		for (From it = first; it < last; ++it)
+			target[offsets[digit(*it, d)]++] = *it;
+	}
+
+public:
+	static const bool supported = true;
+
+	// buffer has room for last - first values. Returns false and leaves the range untouched
+	// if it has a NaN, which no key can order as the comparator does.
+	template <class SortIterator>
+	static bool sort(SortIterator first, SortIterator last, Value* buffer) {
+		size_t count = static_cast<size_t>(last - first);
+		size_t counts[DIGITS][RADIX] = {};
+
+		for (SortIterator it = first; it < last; ++it) {
+			Value v = *it;
+			if (isNaN(v, std::is_floating_point<Value>()))
+				return false;
+
+			Key k = key(v);
+			for (unsigned int d = 0; d < DIGITS; ++d)
+				++counts[d][static_cast<unsigned int>(k >> (8 * d)) & (RADIX - 1)];
+		}
+
+		bool inBuffer = false;
+		for (unsigned int d = 0; d < DIGITS; ++d) {
+			// A byte shared by all keys leaves the order as it is
+			if (counts[d][digit(*first, d)] == count)
+				continue;
+
+			size_t offsets[RADIX];
+			size_t offset = 0;
+			for (unsigned int i = 0; i < RADIX; ++i) {
+				offsets[i] = offset;
+				offset += counts[d][i];
+			}
+
+			if (inBuffer)
+				scatter(buffer, buffer + count, first, offsets, d);
+			else
+				scatter(first, last, buffer, offsets, d);
+			inBuffer = !inBuffer;
+		}
+
+		if (inBuffer)
+			std::copy(buffer, buffer + count, first);
+		return true;
+	}
+};
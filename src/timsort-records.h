@@ -0,0 +1,240 @@
+#include <iterator>
+#include <algorithm>
+#include <memory>
+#include <cstring>
+#include <cstddef>
+
+
+
+// Copy of one record of a width known at run time; records up to INLINE_SIZE bytes wide are
+// kept without an allocation
+class RecordValue {
+private:
+	static const size_t INLINE_SIZE = 64;
+
+	size_t width;
+	unsigned char inlineBytes[INLINE_SIZE];
+	std::unique_ptr<unsigned char[]> heapBytes;
+
+	void assign(const unsigned char* bytes, size_t newWidth) {
+		if (newWidth > INLINE_SIZE && (heapBytes == nullptr || newWidth != width))
+			heapBytes.reset(new unsigned char[newWidth]);
+		width = newWidth;
+		std::memcpy(data(), bytes, width);
+	}
+
+public:
+	RecordValue(const unsigned char* bytes, size_t width)
+		:width(0) {
+		assign(bytes, width);
+	}
+
+	RecordValue(const RecordValue& value)
+		:width(0) {
+		assign(value.data(), value.width);
+	}
+
+	RecordValue(RecordValue&& value)
+		:width(value.width), heapBytes(std::move(value.heapBytes)) {
+		if (heapBytes == nullptr)
+			std::memcpy(inlineBytes, value.inlineBytes, width);
+	}
+
+	RecordValue& operator =(const RecordValue& value) {
+		if (this != &value)
+			assign(value.data(), value.width);
+		return *this;
+	}
+
+	RecordValue& operator =(RecordValue&& value) {
+		if (value.heapBytes != nullptr) {
+			width = value.width;
+			heapBytes = std::move(value.heapBytes);
+		} else {
+			assign(value.data(), value.width);
+		}
+		return *this;
+	}
+
+	const unsigned char* data() const {
+		return heapBytes != nullptr ? heapBytes.get() : inlineBytes;
+	}
+	unsigned char* data() {
+		return heapBytes != nullptr ? heapBytes.get() : inlineBytes;
+	}
+
+	size_t size() const {
+		return width;
+	}
+};
+
+
+// Record in place: assigning to it copies the bytes of the other record, it is never rebound
+class RecordReference {
+private:
+	unsigned char* const bytes;
+	const size_t width;
+
+public:
+	RecordReference(unsigned char* bytes, size_t width)
+		:bytes(bytes), width(width)
+	{}
+
+	RecordReference(const RecordReference& reference) = default;
+
+	RecordReference& operator =(const RecordReference& reference) {
+		std::memmove(bytes, reference.bytes, width);
+		return *this;
+	}
+
+	RecordReference& operator =(const RecordValue& value) {
+		std::memcpy(bytes, value.data(), width);
+		return *this;
+	}
+
+	operator RecordValue() const {
+		return RecordValue(bytes, width);
+	}
+
+	unsigned char* data() const {
+		return bytes;
+	}
+
+	size_t size() const {
+		return width;
+	}
+};
+
+inline void swap(RecordReference a, RecordReference b) {
+	std::swap_ranges(a.data(), a.data() + a.size(), b.data());
+}
+
+
+// Random access iterator over records of width bytes that follow each other in memory, such as
+// a mapped file. Dereferencing gives a RecordReference, the value type is RecordValue.
+class RecordIterator {
+private:
+	unsigned char* bytes;
+	size_t width;
+
+public:
+	typedef std::random_access_iterator_tag iterator_category;
+	typedef RecordValue value_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef void pointer;
+	typedef RecordReference reference;
+
+	RecordIterator()
+		:bytes(nullptr), width(0)
+	{}
+
+	RecordIterator(void* bytes, size_t width)
+		:bytes(static_cast<unsigned char*>(bytes)), width(width)
+	{}
+
+	RecordReference operator *() const {
+		return RecordReference(bytes, width);
+	}
+	RecordReference operator [](difference_type n) const {
+		return RecordReference(bytes + n * static_cast<difference_type>(width), width);
+	}
+
+	RecordIterator& operator ++() {
+		bytes += width;
+		return *this;
+	}
+	RecordIterator operator ++(int) {
+		RecordIterator it = *this;
+		bytes += width;
+		return it;
+	}
+	RecordIterator& operator --() {
+		bytes -= width;
+		return *this;
+	}
+	RecordIterator operator --(int) {
+		RecordIterator it = *this;
+		bytes -= width;
+		return it;
+	}
+
+	RecordIterator& operator +=(difference_type n) {
+		bytes += n * static_cast<difference_type>(width);
+		return *this;
+	}
+	RecordIterator& operator -=(difference_type n) {
+		bytes -= n * static_cast<difference_type>(width);
+		return *this;
+	}
+	RecordIterator operator +(difference_type n) const {
+		return RecordIterator(bytes + n * static_cast<difference_type>(width), width);
+	}
+	RecordIterator operator -(difference_type n) const {
+		return RecordIterator(bytes - n * static_cast<difference_type>(width), width);
+	}
+	friend RecordIterator operator +(difference_type n, const RecordIterator& it) {
+		return it + n;
+	}
+	difference_type operator -(const RecordIterator& it) const {
+		return (bytes - it.bytes) / static_cast<difference_type>(width);
+	}
+
+	bool operator ==(const RecordIterator& it) const {
+		return bytes == it.bytes;
+	}
+	bool operator !=(const RecordIterator& it) const {
+		return bytes != it.bytes;
+	}
+	bool operator <(const RecordIterator& it) const {
+		return bytes < it.bytes;
+	}
+	bool operator >(const RecordIterator& it) const {
+		return bytes > it.bytes;
+	}
+	bool operator <=(const RecordIterator& it) const {
+		return bytes <= it.bytes;
+	}
+	bool operator >=(const RecordIterator& it) const {
+		return bytes >= it.bytes;
+	}
+};
+
+
+// Compares records by a number of type Key at offset, in the byte order of the machine
+template <class Key>
+class RecordKeyComparator {
+private:
+	const size_t offset;
+
+	static Key key(const unsigned char* bytes) {
+		Key k;
+		std::memcpy(&k, bytes, sizeof(Key));
+		return k;
+	}
+
+public:
+	RecordKeyComparator(size_t offset)
+		:offset(offset)
+	{}
+
+	template <class RecordX, class RecordY>
+	bool operator ()(const RecordX& x, const RecordY& y) const {
+		return key(x.data() + offset) < key(y.data() + offset);
+	}
+};
+
+// Compares records by width bytes at offset, as unsigned bytes in lexicographic order
+class RecordBytesComparator {
+private:
+	const size_t offset, width;
+
+public:
+	RecordBytesComparator(size_t offset, size_t width)
+		:offset(offset), width(width)
+	{}
+
+	template <class RecordX, class RecordY>
+	bool operator ()(const RecordX& x, const RecordY& y) const {
+		return std::memcmp(x.data() + offset, y.data() + offset, width) < 0;
+	}
+};
@@ -0,0 +1,554 @@
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include <functional>
+#include <cstdint>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TIMSORT_X86_AVX2
+#include <immintrin.h>
+#endif
+
+
+
+// Sorting networks for chunks of up to 64 keys under std::less or std::greater: 32 and 64-bit
+// integers and floats. Keys that are equal under these comparators are indistinguishable, so
+// an unstable network keeps the sort stable. Signed zeros and NaNs are the exception: a chunk
+// of floats with them is left to the insertion sort.
+template <class Value, class Comparator>
+struct SortingNetworkOrder {
+	static const int value = 0;
+};
+template <class Value>
+struct SortingNetworkOrder<Value, std::less<Value>> {
+	static const int value = 1;
+};
+template <class Value>
+struct SortingNetworkOrder<Value, std::greater<Value>> {
+	static const int value = -1;
+};
+
+
+// Branchless bitonic sort for integers: every comparator puts the smaller key first, each
+// stage starts by comparing mirrored pairs of a block, the rest are half-cleaners
+class ScalarSortingNetwork {
+private:
+	template <class T>
+	static void compareExchange(T& a, T& b) {
+		T x = a, y = b;
+		a = y < x ? y : x;
+		b = y < x ? x : y;
+	}
+
+public:
+	template <class T, unsigned int N>
+	static void sort(T* keys) {
+		for (unsigned int k = 2; k <= N; k *= 2) {
+			for (unsigned int b = 0; b < N; b += k) {
+				for (unsigned int i = 0; i < k / 2; ++i)
+					compareExchange(keys[b + i], keys[b + k - 1 - i]);
+			}
+			for (unsigned int j = k / 4; j > 0; j /= 2) {
+				for (unsigned int b = 0; b < N; b += 2 * j) {
+					for (unsigned int i = 0; i < j; ++i)
+						compareExchange(keys[b + i], keys[b + i + j]);
+				}
+			}
+		}
+	}
+};
+
+
+#ifdef TIMSORT_X86_AVX2
+#define TIMSORT_AVX2 inline __attribute__((target("avx2")))
+
+// Min and max of 8 lanes; the network itself moves lanes as floats, which is free for ints
+template <class T>
+struct Avx2Lanes {
+	static const bool supported = false;
+};
+template <>
+struct Avx2Lanes<int32_t> {
+	static const bool supported = true;
+	static TIMSORT_AVX2 __m256 min(__m256 a, __m256 b) {
+		return _mm256_castsi256_ps(_mm256_min_epi32(_mm256_castps_si256(a), _mm256_castps_si256(b)));
+	}
+	static TIMSORT_AVX2 __m256 max(__m256 a, __m256 b) {
+		return _mm256_castsi256_ps(_mm256_max_epi32(_mm256_castps_si256(a), _mm256_castps_si256(b)));
+	}
+};
+template <>
+struct Avx2Lanes<uint32_t> {
+	static const bool supported = true;
+	static TIMSORT_AVX2 __m256 min(__m256 a, __m256 b) {
+		return _mm256_castsi256_ps(_mm256_min_epu32(_mm256_castps_si256(a), _mm256_castps_si256(b)));
+	}
+	static TIMSORT_AVX2 __m256 max(__m256 a, __m256 b) {
+		return _mm256_castsi256_ps(_mm256_max_epu32(_mm256_castps_si256(a), _mm256_castps_si256(b)));
+	}
+};
+template <>
+struct Avx2Lanes<float> {
+	static const bool supported = true;
+	static TIMSORT_AVX2 __m256 min(__m256 a, __m256 b) {
+		return _mm256_min_ps(a, b);
+	}
+	static TIMSORT_AVX2 __m256 max(__m256 a, __m256 b) {
+		return _mm256_max_ps(a, b);
+	}
+};
+
+// Lanes of the opposite order, for std::greater
+template <class T>
+struct Avx2ReversedLanes {
+	static const bool supported = Avx2Lanes<T>::supported;
+	static TIMSORT_AVX2 __m256 min(__m256 a, __m256 b) {
+		return Avx2Lanes<T>::max(a, b);
+	}
+	static TIMSORT_AVX2 __m256 max(__m256 a, __m256 b) {
+		return Avx2Lanes<T>::min(a, b);
+	}
+};
+
+
+// The same bitonic network on R registers of 8 lanes: every register is sorted on its own,
+// then they are merged pairwise, comparing whole registers while the distance allows it
+template <class T, class Lanes = Avx2Lanes<T>>
+class Avx2SortingNetwork {
+private:
+	template <int shuffle, int blend>
+	static TIMSORT_AVX2 __m256 exchangeInLane(__m256 v) {
+		__m256 p = _mm256_permute_ps(v, shuffle);
+		return _mm256_blend_ps(Lanes::min(v, p), Lanes::max(v, p), blend);
+	}
+	static TIMSORT_AVX2 __m256 sortRegister(__m256 v) {
+		v = exchangeInLane<0xB1, 0xAA>(v);
+		v = exchangeInLane<0x1B, 0xCC>(v);
+		v = exchangeInLane<0xB1, 0xAA>(v);
+		__m256 p = reverse(v);
+		v = _mm256_blend_ps(Lanes::min(v, p), Lanes::max(v, p), 0xF0);
+		v = exchangeInLane<0x4E, 0xCC>(v);
+		return exchangeInLane<0xB1, 0xAA>(v);
+	}
+
+public:
+	static const bool supported = Lanes::supported;
+
+	static TIMSORT_AVX2 __m256 reverse(__m256 v) {
+		return _mm256_permutevar8x32_ps(v, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+	}
+	// Sorts a bitonic register
+	static TIMSORT_AVX2 __m256 halfCleanRegister(__m256 v) {
+		__m256 p = _mm256_permute2f128_ps(v, v, 1);
+		v = _mm256_blend_ps(Lanes::min(v, p), Lanes::max(v, p), 0xF0);
+		v = exchangeInLane<0x4E, 0xCC>(v);
+		return exchangeInLane<0xB1, 0xAA>(v);
+	}
+
+	template <unsigned int R>
+	static TIMSORT_AVX2 void sort(T* keys) {
+		float* data = reinterpret_cast<float*>(keys);
+		__m256 v[R];
+		for (unsigned int i = 0; i < R; ++i)
+			v[i] = sortRegister(_mm256_load_ps(data + 8 * i));
+
+		for (unsigned int k = 2; k <= R; k *= 2) {
+			for (unsigned int b = 0; b < R; b += k) {
+				for (unsigned int i = 0; i < k / 2; ++i) {
+					__m256 x = v[b + i], y = reverse(v[b + k - 1 - i]);
+					v[b + i] = Lanes::min(x, y);
+					v[b + k - 1 - i] = reverse(Lanes::max(x, y));
+				}
+			}
+			for (unsigned int j = k / 4; j > 0; j /= 2) {
+				for (unsigned int b = 0; b < R; b += 2 * j) {
+					for (unsigned int i = 0; i < j; ++i) {
+						__m256 x = v[b + i], y = v[b + i + j];
+						v[b + i] = Lanes::min(x, y);
+						v[b + i + j] = Lanes::max(x, y);
+					}
+				}
+			}
+			for (unsigned int i = 0; i < R; ++i)
+				v[i] = halfCleanRegister(v[i]);
+		}
+
+		for (unsigned int i = 0; i < R; ++i)
+			_mm256_store_ps(data + 8 * i, v[i]);
+	}
+};
+
+
+// One step of a merge of two sorted arrays that emits 8 elements: x and the reversed y
+// are compared lane by lane, the winners form a bitonic register. The lanes won by x are
+// a prefix, so their count tells how far each side moves.
+template <class T, int order>
+class Avx2Merge {
+private:
+	typedef typename std::conditional<order < 0, Avx2ReversedLanes<T>, Avx2Lanes<T>>::type Lanes;
+	typedef Avx2SortingNetwork<T, Lanes> Network;
+
+	static TIMSORT_AVX2 __m256 load(const T* p) {
+		return _mm256_loadu_ps(reinterpret_cast<const float*>(p));
+	}
+	static TIMSORT_AVX2 unsigned int countEqual(__m256 a, __m256 b) {
+		__m256i equal = _mm256_cmpeq_epi32(_mm256_castps_si256(a), _mm256_castps_si256(b));
+		return static_cast<unsigned int>(__builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(equal))));
+	}
+
+public:
+	// The first 8 elements of the merge of x[0, 8) and y[0, 8) go to out;
+	// returns how many of them come from x
+	static TIMSORT_AVX2 unsigned int mergeFront(const T* x, const T* y, T* out) {
+		__m256 vx = load(x);
+		__m256 lo = Lanes::min(vx, Network::reverse(load(y)));
+		_mm256_storeu_ps(reinterpret_cast<float*>(out), Network::halfCleanRegister(lo));
+		return countEqual(lo, vx);
+	}
+
+	// The last 8 elements of the merge of x[0, 8) and y[0, 8) go to out;
+	// returns how many of them come from y
+	static TIMSORT_AVX2 unsigned int mergeBack(const T* x, const T* y, T* out) {
+		__m256 vx = load(x);
+		__m256 hi = Lanes::max(vx, Network::reverse(load(y)));
+		_mm256_storeu_ps(reinterpret_cast<float*>(out), Network::halfCleanRegister(hi));
+		return 8 - countEqual(hi, vx);
+	}
+};
+
+#undef TIMSORT_AVX2
+#endif
+
+
+// One element per step loops of the merges. Arithmetic and pointer elements are picked
+// without a branch, 32-bit integers under std::less or std::greater are merged by blocks
+// with AVX2 first.
+template <class Value, bool branchless = std::is_arithmetic<Value>::value || std::is_pointer<Value>::value>
+class MergeKernel {
+public:
+	// Merges forward until a side runs out or one of them wins minGallop times in a row
+	template <class SortIterator, class Comparator>
+	static void mergeLo(Value*& itBuf, Value* bufEnd, SortIterator& itMain, SortIterator end,
+				SortIterator& itRes, const Comparator& comparator, unsigned int minGallop) {
+		unsigned int bufWins = 0, mainWins = 0;
+		while (itBuf < bufEnd && itMain < end) {
+			if (comparator(*itMain, *itBuf)) {
+				*itRes++ = std::move(*itMain++);
+				bufWins = 0;
+				if (++mainWins >= minGallop)
+					return;
+			} else {
+				*itRes++ = std::move(*itBuf++);
+				mainWins = 0;
+				if (++bufWins >= minGallop)
+					return;
+			}
+		}
+	}
+
+	// Merges backward until a side runs out or one of them wins minGallop times in a row
+	template <class SortIterator, class Comparator>
+	static void mergeHi(Value* bufBegin, Value*& itBuf, SortIterator begin, SortIterator& itMain,
+				SortIterator& itRes, const Comparator& comparator, unsigned int minGallop) {
+		unsigned int bufWins = 0, mainWins = 0;
+		while (itBuf > bufBegin && itMain > begin) {
+			if (comparator(itBuf[-1], itMain[-1])) {
+				*--itRes = std::move(*--itMain);
+				bufWins = 0;
+				if (++mainWins >= minGallop)
+					return;
+			} else {
+				*--itRes = std::move(*--itBuf);
+				mainWins = 0;
+				if (++bufWins >= minGallop)
+					return;
+			}
+		}
+	}
+
+	// Merges two ranges outside of the output until a side runs out
+	template <class SortIterator, class Comparator>
+	static void merge(Value*& itX, Value* endX, Value*& itY, Value* endY,
+				SortIterator& itRes, const Comparator& comparator) {
+		while (itX < endX && itY < endY) {
+			if (comparator(*itY, *itX))
+				*itRes++ = std::move(*itY++);
+			else
+				*itRes++ = std::move(*itX++);
+		}
+	}
+};
+
+template <class Value>
+class MergeKernel<Value, true> {
+private:
+	static const unsigned int BLOCK = 8;
+
+	template <class Comparator>
+	struct BlockMerge {
+#ifdef TIMSORT_X86_AVX2
+		static const bool value = std::is_integral<Value>::value && sizeof(Value) == 4 &&
+					SortingNetworkOrder<Value, Comparator>::value != 0;
+#else
+		static const bool value = false;
+#endif
+	};
+
+	// Block steps take BLOCK elements of both sides and write BLOCK elements of the merge;
+	// they return the count taken from one of the sides, or -1 if blocks can't be merged
+	template <class IteratorX, class IteratorY, class SortIterator, class Comparator>
+	static int mergeBlockFront(IteratorX, IteratorY, SortIterator, const Comparator&, std::false_type) {
+		return -1;
+	}
+	template <class IteratorX, class IteratorY, class SortIterator, class Comparator>
+	static int mergeBlockBack(IteratorX, IteratorY, SortIterator, const Comparator&, std::false_type) {
+		return -1;
+	}
+
+#ifdef TIMSORT_X86_AVX2
+	typedef typename std::conditional<std::is_signed<Value>::value, int32_t, uint32_t>::type Key;
+
+	static bool hasAvx2() {
+		static const bool avx2 = __builtin_cpu_supports("avx2");
+		return avx2;
+	}
+
+	// Count of x elements among the first BLOCK of the merge
+	template <class IteratorX, class IteratorY, class SortIterator, class Comparator>
+	static int mergeBlockFront(IteratorX x, IteratorY y, SortIterator res, const Comparator&, std::true_type) {
+		if (!hasAvx2())
+			return -1;
+
+		Key blockX[BLOCK], blockY[BLOCK], out[BLOCK];
+		for (unsigned int i = 0; i < BLOCK; ++i) {
+			blockX[i] = static_cast<Key>(x[i]);
+			blockY[i] = static_cast<Key>(y[i]);
+		}
+		int fromX = static_cast<int>(Avx2Merge<Key, SortingNetworkOrder<Value, Comparator>::value>::mergeFront(
+					blockX, blockY, out));
+		for (unsigned int i = 0; i < BLOCK; ++i)
+			res[i] = static_cast<Value>(out[i]);
+		return fromX;
+	}
+
+	// Count of y elements among the last BLOCK of the merge
+	template <class IteratorX, class IteratorY, class SortIterator, class Comparator>
+	static int mergeBlockBack(IteratorX x, IteratorY y, SortIterator res, const Comparator&, std::true_type) {
+		if (!hasAvx2())
+			return -1;
+
+		Key blockX[BLOCK], blockY[BLOCK], out[BLOCK];
+		for (unsigned int i = 0; i < BLOCK; ++i) {
+			blockX[i] = static_cast<Key>(x[i]);
+			blockY[i] = static_cast<Key>(y[i]);
+		}
+		int fromY = static_cast<int>(Avx2Merge<Key, SortingNetworkOrder<Value, Comparator>::value>::mergeBack(
+					blockX, blockY, out));
+		for (unsigned int i = 0; i < BLOCK; ++i)
+			res[i] = static_cast<Value>(out[i]);
+		return fromY;
+	}
+#endif
+
+public:
+	template <class SortIterator, class Comparator>
+	static void mergeLo(Value*& itBuf, Value* bufEnd, SortIterator& itMain, SortIterator end,
+				SortIterator& itRes, const Comparator& comparator, unsigned int minGallop) {
+		typedef std::integral_constant<bool, BlockMerge<Comparator>::value> Blocks;
+
+		// A block taken from one side only counts as a streak of its length
+		unsigned int bufWins = 0, mainWins = 0;
+		while (Blocks::value && bufEnd - itBuf >= BLOCK && end - itMain >= BLOCK) {
+			int fromBuf = mergeBlockFront(itBuf, itMain, itRes, comparator, Blocks());
+			if (fromBuf < 0)
+				break;
+
+			itRes += BLOCK;
+			itBuf += fromBuf;
+			itMain += BLOCK - fromBuf;
+			bufWins = fromBuf == BLOCK ? bufWins + BLOCK : 0;
+			mainWins = fromBuf == 0 ? mainWins + BLOCK : 0;
+			if (mainWins >= minGallop || bufWins >= minGallop)
+				return;
+		}
+
+		// Local copies keep the iterators in registers
+		Value* buf = itBuf;
+		SortIterator main = itMain, res = itRes;
+		while (buf < bufEnd && main < end) {
+			Value x = *buf, y = *main;
+			unsigned int takeMain = comparator(y, x);
+			*res++ = takeMain ? y : x;
+			main += takeMain;
+			buf += 1 - takeMain;
+
+			mainWins = (mainWins + 1) * takeMain;
+			bufWins = (bufWins + 1) * (1 - takeMain);
+			if (mainWins + bufWins >= minGallop)
+				break;
+		}
+		itBuf = buf;
+		itMain = main;
+		itRes = res;
+	}
+
+	template <class SortIterator, class Comparator>
+	static void mergeHi(Value* bufBegin, Value*& itBuf, SortIterator begin, SortIterator& itMain,
+				SortIterator& itRes, const Comparator& comparator, unsigned int minGallop) {
+		typedef std::integral_constant<bool, BlockMerge<Comparator>::value> Blocks;
+
+		unsigned int bufWins = 0, mainWins = 0;
+		while (Blocks::value && itBuf - bufBegin >= BLOCK && itMain - begin >= BLOCK) {
+			int fromBuf = mergeBlockBack(itMain - BLOCK, itBuf - BLOCK, itRes - BLOCK, comparator, Blocks());
+			if (fromBuf < 0)
+				break;
+
+			itRes -= BLOCK;
+			itBuf -= fromBuf;
+			itMain -= BLOCK - fromBuf;
+			bufWins = fromBuf == BLOCK ? bufWins + BLOCK : 0;
+			mainWins = fromBuf == 0 ? mainWins + BLOCK : 0;
+			if (mainWins >= minGallop || bufWins >= minGallop)
+				return;
+		}
+
+		Value* buf = itBuf;
+		SortIterator main = itMain, res = itRes;
+		while (buf > bufBegin && main > begin) {
+			Value x = main[-1], y = buf[-1];
+			unsigned int takeMain = comparator(y, x);
+			*--res = takeMain ? x : y;
+			main -= takeMain;
+			buf -= 1 - takeMain;
+
+			mainWins = (mainWins + 1) * takeMain;
+			bufWins = (bufWins + 1) * (1 - takeMain);
+			if (mainWins + bufWins >= minGallop)
+				break;
+		}
+		itBuf = buf;
+		itMain = main;
+		itRes = res;
+	}
+
+	template <class SortIterator, class Comparator>
+	static void merge(Value*& itX, Value* endX, Value*& itY, Value* endY,
+				SortIterator& itRes, const Comparator& comparator) {
+		typedef std::integral_constant<bool, BlockMerge<Comparator>::value> Blocks;
+
+		while (Blocks::value && endX - itX >= BLOCK && endY - itY >= BLOCK) {
+			int fromX = mergeBlockFront(itX, itY, itRes, comparator, Blocks());
+			if (fromX < 0)
+				break;
+
+			itRes += BLOCK;
+			itX += fromX;
+			itY += BLOCK - fromX;
+		}
+
+		Value* curX = itX;
+		Value* curY = itY;
+		SortIterator res = itRes;
+		while (curX < endX && curY < endY) {
+			Value x = *curX, y = *curY;
+			unsigned int takeY = comparator(y, x);
+			*res++ = takeY ? y : x;
+			curY += takeY;
+			curX += 1 - takeY;
+		}
+		itX = curX;
+		itY = curY;
+		itRes = res;
+	}
+};
+
+
+template <class Value, int order, bool enabled = order != 0 && !std::is_same<Value, bool>::value &&
+	((std::is_integral<Value>::value && (sizeof(Value) == 4 || sizeof(Value) == 8)) ||
+	 std::is_same<Value, float>::value)>
+class SortingNetwork {
+public:
+	template <class SortIterator>
+	static bool sort(SortIterator, SortIterator) {
+		return false;
+	}
+};
+
+template <class Value, int order>
+class SortingNetwork<Value, order, true> {
+private:
+	typedef typename std::conditional<sizeof(Value) != 4 || std::is_floating_point<Value>::value, Value,
+		typename std::conditional<std::is_signed<Value>::value, int32_t, uint32_t>::type>::type Key;
+
+	// Padding sorts to the side of the keys that is never copied back
+	static Key padding() {
+		if (std::numeric_limits<Key>::has_infinity)
+			return order > 0 ? std::numeric_limits<Key>::infinity() : -std::numeric_limits<Key>::infinity();
+		return order > 0 ? std::numeric_limits<Key>::max() : std::numeric_limits<Key>::lowest();
+	}
+
+#ifdef TIMSORT_X86_AVX2
+	template <unsigned int N>
+	static bool sortAvx2(Key* keys, std::true_type) {
+		static const bool avx2 = __builtin_cpu_supports("avx2");
+		if (!avx2)
+			return false;
+
+		Avx2SortingNetwork<Key>::template sort<N / 8>(keys);
+		return true;
+	}
+#endif
+	template <unsigned int N>
+	static bool sortAvx2(Key*, std::false_type) {
+		return false;
+	}
+
+	template <unsigned int N>
+	static bool sortKeys(Key* keys) {
+#ifdef TIMSORT_X86_AVX2
+		if (sortAvx2<N>(keys, std::integral_constant<bool, Avx2SortingNetwork<Key>::supported>()))
+			return true;
+#else
+		if (sortAvx2<N>(keys, std::false_type()))
+			return true;
+#endif
+		// Branchy float comparisons make the scalar network slower than the insertion sort
+		if (std::is_floating_point<Key>::value)
+			return false;
+
+		ScalarSortingNetwork::sort<Key, N>(keys);
+		return true;
+	}
+
+public:
+	static const unsigned int MAX_SIZE = 64;
+
+	// Returns false and leaves the range untouched if the network can't sort it
+	template <class SortIterator>
+	static bool sort(SortIterator first, SortIterator last) {
+		unsigned int count = static_cast<unsigned int>(last - first);
+		if (count > MAX_SIZE)
+			return false;
+
+		alignas(32) Key keys[MAX_SIZE];
+		for (unsigned int i = 0; i < count; ++i) {
+			Key v = static_cast<Key>(first[i]);
+			if (std::is_floating_point<Key>::value && (v == 0 || v != v))
+				return false;
+			keys[i] = v;
+		}
+
+		unsigned int size = count <= 16 ? 16 : count <= 32 ? 32 : 64;
+		for (unsigned int i = count; i < size; ++i)
+			keys[i] = padding();
+
+		bool sorted = size == 16 ? sortKeys<16>(keys) : size == 32 ? sortKeys<32>(keys) : sortKeys<64>(keys);
+		if (!sorted)
+			return false;
+
+		// Descending order is sorted ascending with the padding in front
+		for (unsigned int i = 0; i < count; ++i)
+			first[i] = static_cast<Value>(order > 0 ? keys[i] : keys[size - 1 - i]);
+		return true;
+	}
+};
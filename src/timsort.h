@@ -1,9 +1,19 @@
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+
+
 enum EWhatMerge {
 	WM_NoMerge,
 	WM_MergeXY,
 	WM_MergeYZ
 };
 
+enum EMergeStrategy {
+	MS_RunLengths, // needMerge/whatMerge decide on the lengths of the top runs
+	MS_NodePower   // nodePower of each run boundary decides, as in Powersort
+};
+
 class ITimSortParams {
 public:
 	virtual unsigned int minRun(unsigned int n) const = 0;
@@ -11,32 +21,274 @@ public:
 	virtual EWhatMerge whatMerge(unsigned int lenX, unsigned int lenY, unsigned int lenZ) const = 0;
 	virtual unsigned int GetGallop() const = 0;
 
+	// Whether the gallop threshold moves during a sort, starting from GetGallop()
+	virtual bool IsGallopAdaptive() const {
+		return false;
+	}
+
+	// Auxiliary memory (in bytes) a merge may use; merges that do not fit are done in place
+	virtual size_t GetBufferBudget() const {
+		return static_cast<size_t>(-1);
+	}
+
+	virtual EMergeStrategy GetMergeStrategy() const {
+		return MS_RunLengths;
+	}
+
+	// Power of the boundary between runs [beginX, beginY) and [beginY, endY) of n elements;
+	// runs below a boundary with a greater power are merged first
+	virtual unsigned int nodePower(size_t /*beginX*/, size_t /*beginY*/, size_t /*endY*/, size_t /*n*/) const {
+		return 0;
+	}
+
+	// Threads (the calling one included) used by a sort; comparators must allow concurrent calls
+	virtual unsigned int GetThreadsCount() const {
+		return 1;
+	}
+
 	virtual ~ITimSortParams() {};
 };
 
+// Compile-time counterpart of ITimSortParams: a policy provides minRun, needMerge, whatMerge
+// and GetGallop as static or const members and may inherit the remaining ones from here
+class TimSortPolicyBase {
+public:
+	static bool IsGallopAdaptive() {
+		return false;
+	}
+
+	static size_t GetBufferBudget() {
+		return static_cast<size_t>(-1);
+	}
+
+	static EMergeStrategy GetMergeStrategy() {
+		return MS_RunLengths;
+	}
+
+	static unsigned int nodePower(size_t /*beginX*/, size_t /*beginY*/, size_t /*endY*/, size_t /*n*/) {
+		return 0;
+	}
+
+	static unsigned int GetThreadsCount() {
+		return 1;
+	}
+};
+
+// Wraps a comparison function known at compile time so that calls to it can be inlined
+template <class Function, Function function>
+class StaticComparator {
+public:
+	template <class T>
+	bool operator ()(const T& a, const T& b) const {
+		return function(a, b);
+	}
+};
+
+#define TIMSORT_STATIC_COMPARATOR(function) StaticComparator<decltype(&function), &function>()
+
 
 #include "timsort-internal.h"
+#include "timsort-keys.h"
+#include "timsort-external.h"
+#include "timsort-kway.h"
+#include "timsort-records.h"
 
 
-template <class RandomAccessIterator, class Compare>
+template <class RandomAccessIterator, class Compare, class Params>
 void TimSort(RandomAccessIterator first, RandomAccessIterator last,
-			const Compare& comp, const ITimSortParams& params) {
+			const Compare& comp, const Params& params) {
 
-	TimSortController<RandomAccessIterator, Compare>::sort(first, last, comp, params);
+	TimSortController<RandomAccessIterator, typename std::decay<Compare>::type, Params>::sort(
+				first, last, comp, params);
 }
 
 template <class RandomAccessIterator, class Compare>
 void TimSort(RandomAccessIterator first, RandomAccessIterator last, const Compare& comp) {
-	TimSortController<RandomAccessIterator, Compare>::sort(first, last, comp);
+	TimSort(first, last, comp, DefaultTimSortPolicy());
+}
+
+// Sorts on the threads of pool; the pool can be shared by consecutive sorts
+template <class RandomAccessIterator, class Compare, class Params>
+void TimSort(RandomAccessIterator first, RandomAccessIterator last,
+			const Compare& comp, const Params& params, TimSortThreadPool& pool) {
+
+	TimSortController<RandomAccessIterator, typename std::decay<Compare>::type, Params>::sort(
+				first, last, comp, params, pool);
+}
+
+template <class RandomAccessIterator, class Compare>
+void TimSort(RandomAccessIterator first, RandomAccessIterator last,
+			const Compare& comp, TimSortThreadPool& pool) {
+	TimSort(first, last, comp, DefaultTimSortPolicy(), pool);
 }
 
 template <class RandomAccessIterator>
 void TimSort(RandomAccessIterator first, RandomAccessIterator last, const ITimSortParams& params) {
-	TimSortController<RandomAccessIterator>::sort(first, last, params);
+	typedef typename std::iterator_traits<RandomAccessIterator>::value_type Value;
+	TimSort(first, last, std::less<Value>(), params);
 }
 
 template <class RandomAccessIterator>
 void TimSort(RandomAccessIterator first, RandomAccessIterator last) {
-	TimSortController<RandomAccessIterator>::sort(first, last);
+	typedef typename std::iterator_traits<RandomAccessIterator>::value_type Value;
+	TimSort(first, last, std::less<Value>());
+}
+
+
+// Puts the middle - first smallest elements to [first, middle) in sorted order, keeping equal
+// ones stable. Parts of runs that can't get into [first, middle) are dropped unmerged.
+template <class RandomAccessIterator, class Compare>
+void TimPartialSort(RandomAccessIterator first, RandomAccessIterator middle, RandomAccessIterator last,
+			const Compare& comp) {
+
+	TimSortController<RandomAccessIterator, typename std::decay<Compare>::type, DefaultTimSortPolicy>::partialSort(
+				first, middle, last, comp, DefaultTimSortPolicy());
+}
+
+template <class RandomAccessIterator>
+void TimPartialSort(RandomAccessIterator first, RandomAccessIterator middle, RandomAccessIterator last) {
+	typedef typename std::iterator_traits<RandomAccessIterator>::value_type Value;
+	TimPartialSort(first, middle, last, std::less<Value>());
+}
+
+// The k smallest elements (all of them if there are fewer) in sorted order from first;
+// returns the end of them
+template <class RandomAccessIterator, class Compare>
+RandomAccessIterator TimSortTopK(RandomAccessIterator first, RandomAccessIterator last, size_t k,
+			const Compare& comp) {
+	RandomAccessIterator middle = static_cast<size_t>(last - first) > k ? first + k : last;
+	TimPartialSort(first, middle, last, comp);
+	return middle;
+}
+
+template <class RandomAccessIterator>
+RandomAccessIterator TimSortTopK(RandomAccessIterator first, RandomAccessIterator last, size_t k) {
+	typedef typename std::iterator_traits<RandomAccessIterator>::value_type Value;
+	return TimSortTopK(first, last, k, std::less<Value>());
+}
+
+
+// Sorts [first, last) whose prefix [first, sortedEnd) is sorted already, as after appending
+// a batch to a sorted buffer: only the batch is sorted, then it is merged into the prefix
+template <class RandomAccessIterator, class Compare, class Params>
+void TimSortAppend(RandomAccessIterator first, RandomAccessIterator sortedEnd, RandomAccessIterator last,
+			const Compare& comp, const Params& params) {
+
+	TimSortController<RandomAccessIterator, typename std::decay<Compare>::type, Params>::append(
+				first, sortedEnd, last, comp, params);
+}
+
+template <class RandomAccessIterator, class Compare>
+void TimSortAppend(RandomAccessIterator first, RandomAccessIterator sortedEnd, RandomAccessIterator last,
+			const Compare& comp) {
+	TimSortAppend(first, sortedEnd, last, comp, DefaultTimSortPolicy());
+}
+
+template <class RandomAccessIterator>
+void TimSortAppend(RandomAccessIterator first, RandomAccessIterator sortedEnd, RandomAccessIterator last) {
+	typedef typename std::iterator_traits<RandomAccessIterator>::value_type Value;
+	TimSortAppend(first, sortedEnd, last, std::less<Value>());
+}
+
+
+// Merges the sorted ranges given as pairs of iterators to out at once, with a loser tree;
+// equal elements come from the earlier range first. Returns the end of the output.
+template <class Ranges, class OutputIterator, class Compare, class Params>
+OutputIterator TimSortMergeK(const Ranges& ranges, OutputIterator out, const Compare& comp, const Params& params) {
+	typedef typename Ranges::value_type::first_type RandomAccessIterator;
+	return KWayMergeController<RandomAccessIterator, typename std::decay<Compare>::type, Params>::merge(
+				ranges, out, comp, params);
+}
+
+template <class Ranges, class OutputIterator, class Compare>
+OutputIterator TimSortMergeK(const Ranges& ranges, OutputIterator out, const Compare& comp) {
+	return TimSortMergeK(ranges, out, comp, DefaultTimSortPolicy());
+}
+
+template <class Ranges, class OutputIterator>
+OutputIterator TimSortMergeK(const Ranges& ranges, OutputIterator out) {
+	typedef typename std::iterator_traits<typename Ranges::value_type::first_type>::value_type Value;
+	return TimSortMergeK(ranges, out, std::less<Value>());
+}
+
+// Merges the sorted runs of [first, last) that start at first and at every iterator of
+// runBounds, using the buffer budget of params; see KWayMergeController::mergeInPlace
+template <class RandomAccessIterator, class RunBounds, class Compare, class Params>
+void TimSortMergeKInPlace(RandomAccessIterator first, RandomAccessIterator last, const RunBounds& runBounds,
+			const Compare& comp, const Params& params) {
+
+	KWayMergeController<RandomAccessIterator, typename std::decay<Compare>::type, Params>::mergeInPlace(
+				first, last, runBounds, comp, params);
 }
 
+template <class RandomAccessIterator, class RunBounds, class Compare>
+void TimSortMergeKInPlace(RandomAccessIterator first, RandomAccessIterator last, const RunBounds& runBounds,
+			const Compare& comp) {
+	TimSortMergeKInPlace(first, last, runBounds, comp, DefaultTimSortPolicy());
+}
+
+template <class RandomAccessIterator, class RunBounds>
+void TimSortMergeKInPlace(RandomAccessIterator first, RandomAccessIterator last, const RunBounds& runBounds) {
+	typedef typename std::iterator_traits<RandomAccessIterator>::value_type Value;
+	TimSortMergeKInPlace(first, last, runBounds, std::less<Value>());
+}
+
+
+// Sorts by keyFunction(element) or element.*keyFunction. Every key is computed once unless
+// TimSortCheapKey says the projection is cheap, as it does for member pointers.
+template <class RandomAccessIterator, class KeyFunction, class KeyCompare>
+void TimSortByKey(RandomAccessIterator first, RandomAccessIterator last,
+			const KeyFunction& keyFunction, const KeyCompare& keyComp) {
+	KeySortController<RandomAccessIterator>::sortByKey(first, last, keyFunction, keyComp);
+}
+
+template <class RandomAccessIterator, class KeyFunction>
+void TimSortByKey(RandomAccessIterator first, RandomAccessIterator last, const KeyFunction& keyFunction) {
+	typedef typename std::iterator_traits<RandomAccessIterator>::value_type Value;
+	typedef typename std::decay<decltype(projectKey(keyFunction, std::declval<const Value&>()))>::type Key;
+	TimSortByKey(first, last, keyFunction, std::less<Key>());
+}
+
+// Sorts by comp, keeping prefixFunction(element) next to every element: comp is only called
+// for equal prefixes. A smaller prefix must mean a smaller element, as with StringPrefix.
+template <class RandomAccessIterator, class PrefixFunction, class Compare>
+void TimSortByPrefix(RandomAccessIterator first, RandomAccessIterator last,
+			const PrefixFunction& prefixFunction, const Compare& comp) {
+	KeySortController<RandomAccessIterator>::sortByPrefix(first, last, prefixFunction, comp);
+}
+
+// Argsort: indices gets the positions of [first, last) in stably sorted order and has room
+// for last - first of them. The elements don't move; applyPermutation moves them later.
+template <class RandomAccessIterator, class IndexIterator, class Compare>
+void TimSortIndices(RandomAccessIterator first, RandomAccessIterator last,
+			IndexIterator indices, const Compare& comp) {
+	KeySortController<RandomAccessIterator>::sortIndices(first, last, indices, comp);
+}
+
+template <class Index = size_t, class RandomAccessIterator, class Compare>
+std::vector<Index> TimSortIndices(RandomAccessIterator first, RandomAccessIterator last, const Compare& comp) {
+	std::vector<Index> indices(static_cast<size_t>(last - first));
+	TimSortIndices(first, last, indices.begin(), comp);
+	return indices;
+}
+
+template <class Index = size_t, class RandomAccessIterator>
+std::vector<Index> TimSortIndices(RandomAccessIterator first, RandomAccessIterator last) {
+	typedef typename std::iterator_traits<RandomAccessIterator>::value_type Value;
+	return TimSortIndices<Index>(first, last, std::less<Value>());
+}
+
+
+// Sorts a binary file of fixed-width records into outputPath, using about memoryBudget bytes
+// of memory; see ExternalSortController. Returns false on an I/O error.
+template <class Record, class Compare>
+bool TimSortFile(const std::string& inputPath, const std::string& outputPath,
+			const Compare& comp, size_t memoryBudget) {
+	return ExternalSortController<Record, typename std::decay<Compare>::type>::sort(
+				inputPath, outputPath, comp, memoryBudget);
+}
+
+template <class Record>
+bool TimSortFile(const std::string& inputPath, const std::string& outputPath, size_t memoryBudget) {
+	return TimSortFile<Record>(inputPath, outputPath, std::less<Record>(), memoryBudget);
+}
@@ -0,0 +1,137 @@
+// Sorts a file of fixed-width records in place: the file is mapped to memory and sorted
+// by TimSort through a RecordIterator, without reading or writing it by parts.
+//
+// Usage: timsort-file FILE RECORD_WIDTH KEY_OFFSET KEY_TYPE [KEY_WIDTH]
+//   KEY_TYPE is u32, u64, i64, f64 (in the byte order of the machine) or bytes;
+//   KEY_WIDTH is the width of a bytes key, compared as unsigned bytes.
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../src/timsort.h"
+
+
+// Merges of RecordValues use at most that much memory, the rest are done in place
+class FileSortPolicy: public DefaultTimSortPolicy {
+public:
+	static size_t GetBufferBudget() {
+		return static_cast<size_t>(256) << 20;
+	}
+};
+
+template <class Comparator>
+void sortRecords(unsigned char* data, size_t recordsCount, size_t recordWidth, const Comparator& comparator) {
+	RecordIterator first(data, recordWidth);
+	TimSort(first, first + static_cast<std::ptrdiff_t>(recordsCount), comparator, FileSortPolicy());
+}
+
+bool parseSize(const char* text, size_t& value) {
+	char* end = nullptr;
+	errno = 0;
+	unsigned long long parsed = std::strtoull(text, &end, 10);
+	if (errno != 0 || end == text || *end != '\0')
+		return false;
+	value = static_cast<size_t>(parsed);
+	return true;
+}
+
+int usage() {
+	std::cerr << "Usage: timsort-file FILE RECORD_WIDTH KEY_OFFSET KEY_TYPE [KEY_WIDTH]\n"
+				"  KEY_TYPE: u32, u64, i64, f64 or bytes; KEY_WIDTH is required for bytes\n";
+	return 2;
+}
+
+int fail(const std::string& what) {
+	std::cerr << "timsort-file: " << what << ": " << std::strerror(errno) << '\n';
+	return 1;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 5 || argc > 6)
+		return usage();
+
+	const std::string path = argv[1];
+	const std::string keyType = argv[4];
+	size_t recordWidth, keyOffset, keyWidth = 0;
+	if (!parseSize(argv[2], recordWidth) || !parseSize(argv[3], keyOffset) || recordWidth == 0)
+		return usage();
+
+	if (keyType == "u32")
+		keyWidth = sizeof(uint32_t);
+	else if (keyType == "u64")
+		keyWidth = sizeof(uint64_t);
+	else if (keyType == "i64")
+		keyWidth = sizeof(int64_t);
+	else if (keyType == "f64")
+		keyWidth = sizeof(double);
+	else if (keyType != "bytes" || argc != 6 || !parseSize(argv[5], keyWidth) || keyWidth == 0)
+		return usage();
+
+	if (keyType != "bytes" && argc == 6)
+		return usage();
+	if (keyOffset > recordWidth || keyWidth > recordWidth - keyOffset) {
+		std::cerr << "timsort-file: the key does not fit in a record\n";
+		return 2;
+	}
+
+	int fd = open(path.c_str(), O_RDWR);
+	if (fd < 0)
+		return fail(path);
+
+	struct stat status;
+	if (fstat(fd, &status) != 0) {
+		close(fd);
+		return fail(path);
+	}
+
+	size_t size = static_cast<size_t>(status.st_size);
+	if (size % recordWidth != 0) {
+		std::cerr << "timsort-file: " << path << ": the size is not a multiple of the record width\n";
+		close(fd);
+		return 1;
+	}
+	if (size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED)
+		return fail(path);
+
+	// Run detection scans the whole file first; the merges then go over runs formed in it
+	// from both ends, so the pages are asked for at once and kept rather than read behind
+	madvise(mapping, size, MADV_WILLNEED);
+
+	unsigned char* data = static_cast<unsigned char*>(mapping);
+	size_t recordsCount = size / recordWidth;
+	if (keyType == "u32")
+		sortRecords(data, recordsCount, recordWidth, RecordKeyComparator<uint32_t>(keyOffset));
+	else if (keyType == "u64")
+		sortRecords(data, recordsCount, recordWidth, RecordKeyComparator<uint64_t>(keyOffset));
+	else if (keyType == "i64")
+		sortRecords(data, recordsCount, recordWidth, RecordKeyComparator<int64_t>(keyOffset));
+	else if (keyType == "f64")
+		sortRecords(data, recordsCount, recordWidth, RecordKeyComparator<double>(keyOffset));
+	else
+		sortRecords(data, recordsCount, recordWidth, RecordBytesComparator(keyOffset, keyWidth));
+
+	bool synced = msync(mapping, size, MS_SYNC) == 0;
+	int syncError = errno;
+	munmap(mapping, size);
+	if (!synced) {
+		errno = syncError;
+		return fail(path);
+	}
+	return 0;
+}